@@ -0,0 +1,669 @@
+#include <fstream>
+#include <sstream>
+#include <charconv>
+#include <unordered_map>
+#include "batch.h"
+#include "visitor.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __SSE4_1__
+#include <smmintrin.h>
+#endif
+
+// records are evaluated this many at a time, which keeps every column of a small
+// script in cache while still amortizing the tree walk
+static const size_t BATCH = 4096;
+
+void Column::Narrow()
+{
+    if( kind != VALUES || vals.empty() )
+        return;
+
+    Kind k;
+    if( vals[0].isIntType() ) k = INTS;
+    else if( vals[0].isBoolType() ) k = BOOLS;
+    else return;
+
+    for( const Value& v : vals ) {
+        if( k == INTS ? !v.isIntType() : !v.isBoolType() )
+            return;
+    }
+    ints.resize(vals.size());
+    for( size_t i = 0; i < vals.size(); i++ )
+        ints[i] = k == INTS ? vals[i].getInteger() : vals[i].getBoolean();
+    vals.clear();
+    kind = k;
+}
+
+void Column::Widen()
+{
+    if( kind == VALUES )
+        return;
+    vals.resize(ints.size());
+    for( size_t i = 0; i < ints.size(); i++ )
+        vals[i] = At(i);
+    ints.clear();
+    kind = VALUES;
+}
+
+// Each operator gives a scalar form and, where SSE2 has a matching instruction, a form
+// that works on four ints at once. Arithmetic wraps like the tree walker does in practice.
+struct AddOp {
+    static const bool VECTOR = true;
+    static int Scalar(int a, int b) { return int(unsigned(a) + unsigned(b)); }
+#ifdef __SSE2__
+    static __m128i Vector(__m128i a, __m128i b) { return _mm_add_epi32(a, b); }
+#endif
+};
+
+struct SubOp {
+    static const bool VECTOR = true;
+    static int Scalar(int a, int b) { return int(unsigned(a) - unsigned(b)); }
+#ifdef __SSE2__
+    static __m128i Vector(__m128i a, __m128i b) { return _mm_sub_epi32(a, b); }
+#endif
+};
+
+// SSE2 has no 32-bit multiply; the scalar loop is left to the auto-vectorizer
+struct MulOp {
+#ifdef __SSE4_1__
+    static const bool VECTOR = true;
+    static __m128i Vector(__m128i a, __m128i b) { return _mm_mullo_epi32(a, b); }
+#else
+    static const bool VECTOR = false;
+#endif
+    static int Scalar(int a, int b) { return int(unsigned(a) * unsigned(b)); }
+};
+
+struct AndOp {
+    static const bool VECTOR = true;
+    static int Scalar(int a, int b) { return a & b; }
+#ifdef __SSE2__
+    static __m128i Vector(__m128i a, __m128i b) { return _mm_and_si128(a, b); }
+#endif
+};
+
+struct OrOp {
+    static const bool VECTOR = true;
+    static int Scalar(int a, int b) { return a | b; }
+#ifdef __SSE2__
+    static __m128i Vector(__m128i a, __m128i b) { return _mm_or_si128(a, b); }
+#endif
+};
+
+// comparisons produce 0 or 1; the SSE2 compares give all ones for true, so the
+// result is masked down to 1, or inverted first for the complementary tests
+#ifdef __SSE2__
+#define COMPARE_OP(NAME, EXPR, TEST, INVERT) \
+struct NAME { \
+    static const bool VECTOR = true; \
+    static int Scalar(int a, int b) { return EXPR; } \
+    static __m128i Vector(__m128i a, __m128i b) { \
+        return INVERT ? _mm_andnot_si128(TEST(a, b), _mm_set1_epi32(1)) \
+                      : _mm_and_si128(TEST(a, b), _mm_set1_epi32(1)); \
+    } \
+};
+#else
+#define COMPARE_OP(NAME, EXPR, TEST, INVERT) \
+struct NAME { \
+    static const bool VECTOR = false; \
+    static int Scalar(int a, int b) { return EXPR; } \
+};
+#endif
+
+COMPARE_OP(EqOp, a == b, _mm_cmpeq_epi32, false)
+COMPARE_OP(NeOp, a != b, _mm_cmpeq_epi32, true)
+COMPARE_OP(LtOp, a < b, _mm_cmplt_epi32, false)
+COMPARE_OP(LeOp, a <= b, _mm_cmpgt_epi32, true)
+COMPARE_OP(GtOp, a > b, _mm_cmpgt_epi32, false)
+COMPARE_OP(GeOp, a >= b, _mm_cmplt_epi32, true)
+
+template <class Op>
+static void IntKernel(const int *a, const int *b, int *out, size_t n)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    if constexpr( Op::VECTOR ) {
+        for( ; i + 4 <= n; i += 4 ) {
+            __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+            __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), Op::Vector(va, vb));
+        }
+    }
+#endif
+    for( ; i < n; i++ )
+        out[i] = Op::Scalar(a[i], b[i]);
+}
+
+// there is no vector integer divide; a zero divisor in an active record sends the whole
+// column down the Value path so the failures come out the same as in the tree walker
+static bool DivideKernel(const int *a, const int *b, int *out, size_t n, const char *active)
+{
+    for( size_t i = 0; i < n; i++ ) {
+        if( b[i] == 0 && active[i] )
+            return false;
+    }
+    for( size_t i = 0; i < n; i++ )
+        out[i] = b[i] == 0 ? 0 : Quotient(a[i], b[i]);
+    return true;
+}
+
+// Undefined is a variable's entry for a record that never set it: a failure whose line
+// is filled in where the variable is read
+static Value Undefined()
+{
+    return Value::Failure("", 0);
+}
+
+// PrintFinder numbers the print statements in program order; each gets an output column
+class PrintFinder : public TreeVisitor<PrintFinder> {
+public:
+    map<ParseTree*, int>	index;
+    vector<int>				lines;
+
+    void VisitStmtList(StmtList *t) { VisitStatements(t); }
+    void VisitIf(IfStatement *t) { Visit(t->right); }
+    void VisitPrint(PrintStatement *t) {
+        index[t] = lines.size();
+        lines.push_back(t->GetLinenum());
+    }
+};
+
+// BatchRunner evaluates expressions a column at a time and statements under a mask of
+// the records that reach them. A record that fails drops out of every later statement,
+// just as a single run would stop at its first failure. Expressions are only worked
+// out for the active records, the live ones that reach the statement and have not
+// failed earlier in it; the int kernels run over whole columns, but anything that
+// costs more or has an effect skips the rest.
+class BatchRunner : public TreeVisitor<BatchRunner, Column> {
+    const map<string, Value>&	globals;
+    const map<ParseTree*, int>&	printIndex;
+    size_t	n;
+
+    std::unordered_map<const string*, Column>	vars;
+    vector<char>	alive;
+    vector<char>	active;
+
+    // Activate sets active to the live records in reach and says whether there are any
+    bool Activate(const vector<char>& reach) {
+        bool any = false;
+        for( size_t i = 0; i < n; i++ ) {
+            active[i] = reach[i] && alive[i];
+            any |= active[i];
+        }
+        return any;
+    }
+
+    // Then visits t for the active records where first did not fail, since the tree
+    // walker stops at the first operand that fails
+    Column Then(const Column& first, ParseTree *t) {
+        if( first.kind == Column::VALUES ) {
+            for( size_t i = 0; i < n; i++ ) {
+                if( active[i] && first.vals[i].isFailure() ) {
+                    vector<char> saved = active;
+                    for( ; i < n; i++ )
+                        active[i] &= !first.vals[i].isFailure();
+                    Column c = Visit(t);
+                    active.swap(saved);
+                    return c;
+                }
+            }
+        }
+        return Visit(t);
+    }
+
+    Column Broadcast(const Value& v) {
+        Column c(Column::VALUES, n);
+        for( size_t i = 0; i < n; i++ )
+            c.vals[i] = v;
+        c.Narrow();
+        return c;
+    }
+
+    void Fail(size_t i, const Value& v) {
+        alive[i] = 0;
+        errors[i] = v;
+    }
+
+    // Rows applies a Value operator record by record, the way the tree walker would
+    template <class F>
+    Column Rows(ParseTree *t, const Column& l, const Column& r, F op) {
+        Column out(Column::VALUES, n);
+        for( size_t i = 0; i < n; i++ ) {
+            if( !active[i] )
+                continue;
+            Value a = l.At(i);
+            out.vals[i] = a.isFailure() ? a : t->Located(op(a, r.At(i)));
+        }
+        out.Narrow();
+        return out;
+    }
+
+    template <class Op>
+    Column Ints(const Column& l, const Column& r, Column::Kind k) {
+        Column out(k, n);
+        IntKernel<Op>(l.ints.data(), r.ints.data(), out.ints.data(), n);
+        return out;
+    }
+
+public:
+    vector<Value>			errors;
+    vector<vector<string>>	cells;
+
+    BatchRunner(const map<string, Value>& globals, const map<ParseTree*, int>& printIndex, size_t nprints)
+        : globals(globals), printIndex(printIndex), n(0), cells(nprints) {}
+
+    void Bind(const string *name, Column c) { vars[name] = std::move(c); }
+
+    void Start(size_t records) {
+        n = records;
+        vars.clear();
+        alive.assign(n, 1);
+        active.assign(n, 1);
+        errors.assign(n, Value());
+        for( auto& col : cells )
+            col.assign(n, string());
+    }
+
+    Column VisitNode(ParseTree *t) {
+        return Broadcast(Value::Failure("Unexpected node in expression", t->GetLinenum()));
+    }
+    Column VisitMemo(MemoExpr *t) { return Visit(t->left); }
+    Column VisitIConst(IConst *t) { return Broadcast(Value(t->getINTEGER())); }
+    Column VisitBoolConst(BoolConst *t) { return Broadcast(Value(t->getBOOLEAN())); }
+    Column VisitSConst(SConst *t) { return Broadcast(Value(*t->getSTRING())); }
+
+    Column VisitIdent(Ident *t) {
+        auto it = vars.find(t->getSYMBOL());
+        if( it == vars.end() ) {
+            auto g = globals.find(*t->getSYMBOL());
+            Column c = Broadcast(g != globals.end() ? g->second : Value::Failure("", t->GetLinenum()));
+            if( g == globals.end() )
+                return c;
+            it = vars.emplace(t->getSYMBOL(), std::move(c)).first;
+        }
+        Column c = it->second;
+        if( c.kind == Column::VALUES ) {
+            // records that never assigned the variable read it as undefined
+            for( Value& v : c.vals ) {
+                if( v.isFailure() && v.getErrorLine() == 0 )
+                    v.setErrorLine(t->GetLinenum());
+            }
+        }
+        return c;
+    }
+
+    // an assignment inside an expression stores for the active records and gives them
+    // what Assignment::Eval returns
+    Column VisitAssignment(Assignment *t) { return Assign(t); }
+
+    Column VisitArith(ParseTree *t) {
+        Column l = Visit(t->left);
+        Column r = Then(l, t->right);
+        NodeKind k = t->GetKind();
+        if( l.kind == Column::INTS && r.kind == Column::INTS ) {
+            switch( k ) {
+                case PLUSNODE:	return Ints<AddOp>(l, r, Column::INTS);
+                case MINUSNODE:	return Ints<SubOp>(l, r, Column::INTS);
+                case TIMESNODE:	return Ints<MulOp>(l, r, Column::INTS);
+                default: {
+                    Column out(Column::INTS, n);
+                    if( DivideKernel(l.ints.data(), r.ints.data(), out.ints.data(), n, active.data()) )
+                        return out;
+                }
+            }
+        }
+        return Rows(t, l, r, [k](Value& a, const Value& b) {
+            switch( k ) {
+                case PLUSNODE:	return a + b;
+                case MINUSNODE:	return a - b;
+                case TIMESNODE:	return a * b;
+                default:		return a / b;
+            }
+        });
+    }
+
+    Column VisitCompare(ParseTree *t) {
+        Column l = Visit(t->left);
+        Column r = Then(l, t->right);
+        NodeKind k = t->GetKind();
+        bool ints = l.kind == Column::INTS && r.kind == Column::INTS;
+        bool bools = l.kind == Column::BOOLS && r.kind == Column::BOOLS && (k == EQNODE || k == NEQNODE);
+        if( ints || bools ) {
+            switch( k ) {
+                case EQNODE:	return Ints<EqOp>(l, r, Column::BOOLS);
+                case NEQNODE:	return Ints<NeOp>(l, r, Column::BOOLS);
+                case LTNODE:	return Ints<LtOp>(l, r, Column::BOOLS);
+                case LEQNODE:	return Ints<LeOp>(l, r, Column::BOOLS);
+                case GTNODE:	return Ints<GtOp>(l, r, Column::BOOLS);
+                default:		return Ints<GeOp>(l, r, Column::BOOLS);
+            }
+        }
+        return Rows(t, l, r, [k](Value& a, const Value& b) {
+            switch( k ) {
+                case EQNODE:	return a == b;
+                case NEQNODE:	return a != b;
+                case LTNODE:	return a < b;
+                case LEQNODE:	return a <= b;
+                case GTNODE:	return a > b;
+                default:		return a >= b;
+            }
+        });
+    }
+
+    // the logic operators check their operands in a different order from the others,
+    // so the slow path spells out LogicAndExpr and LogicOrExpr
+    Column VisitLogic(ParseTree *t) {
+        bool isAnd = t->GetKind() == ANDNODE;
+        Column l, r;
+        if( isAnd ) {
+            l = Visit(t->left);
+            r = Then(l, t->right);
+        }
+        else {
+            r = Visit(t->right);
+            l = Then(r, t->left);
+        }
+        if( l.kind == Column::BOOLS && r.kind == Column::BOOLS )
+            return isAnd ? Ints<AndOp>(l, r, Column::BOOLS) : Ints<OrOp>(l, r, Column::BOOLS);
+
+        Column out(Column::VALUES, n);
+        for( size_t i = 0; i < n; i++ ) {
+            if( !active[i] )
+                continue;
+            Value a = l.At(i), b = r.At(i);
+            Value &res = out.vals[i];
+            if( isAnd ) {
+                if( a.isFailure() ) res = a;
+                else if( b.isFailure() ) res = b;
+                else if( a.isBoolType() && b.isBoolType() ) res = Value(a.isTrue() && b.isTrue());
+                else res = Value::Failure("BOOL Type expected", t->GetLinenum());
+            }
+            else {
+                if( b.isFailure() ) res = b;
+                else if( a.isFailure() ) res = a;
+                else if( a.isBoolType() || b.isBoolType() ) res = Value(a.isTrue() || b.isTrue());
+                else res = Value::Failure("BOOL Type Expected", t->GetLinenum());
+            }
+        }
+        out.Narrow();
+        return out;
+    }
+
+    // Assign stores the right-hand side for the active records where it does not fail
+    // and returns the failures, or the empty Value an assignment evaluates to
+    Column Assign(ParseTree *t) {
+        if( !t->left->IdentDefined() )
+            return Broadcast(Value::Failure("IDENT Type Expected", t->GetLinenum()));
+
+        Column c = Visit(t->right);
+        Column result(Column::VALUES, n);
+        vector<char> store(n, 0);
+        bool everyRecord = true;
+        for( size_t i = 0; i < n; i++ ) {
+            if( active[i] ) {
+                if( c.kind == Column::VALUES && c.vals[i].isFailure() )
+                    result.vals[i] = c.vals[i];
+                else
+                    store[i] = 1;
+            }
+            everyRecord &= store[i] || !alive[i];
+        }
+
+        auto it = vars.find(t->left->getSYMBOL());
+        if( everyRecord || it == vars.end() ) {
+            if( !everyRecord ) {
+                // records the assignment skipped keep the global, or leave the variable
+                // undefined
+                auto g = globals.find(*t->left->getSYMBOL());
+                Value skipped = g != globals.end() ? g->second : Undefined();
+                c.Widen();
+                for( size_t i = 0; i < n; i++ ) {
+                    if( !store[i] ) c.vals[i] = skipped;
+                }
+            }
+            vars[t->left->getSYMBOL()] = std::move(c);
+            return result;
+        }
+
+        Column &var = it->second;
+        if( var.kind != c.kind || var.kind == Column::VALUES ) {
+            var.Widen();
+            for( size_t i = 0; i < n; i++ ) {
+                if( store[i] ) var.vals[i] = c.At(i);
+            }
+            var.Narrow();
+        }
+        else {
+            for( size_t i = 0; i < n; i++ ) {
+                if( store[i] ) var.ints[i] = c.ints[i];
+            }
+        }
+        return result;
+    }
+
+    // Exec runs a statement for the live records among those in reach. Each top-level
+    // statement costs every record that runs it a step of the budget, as it would cost
+    // a single run; the limits cover the whole batch.
+    void Exec(ParseTree *t, const vector<char>& reach) {
+        switch( t->GetKind() ) {
+            case LISTNODE:
+                for( ParseTree *sl = t; sl; sl = sl->right ) {
+                    for( size_t i = 0; i < n; i++ ) {
+                        if( reach[i] && alive[i] && !evalBudget.Tick() )
+                            Fail(i, Value::Failure(evalBudget.exceeded, sl->left->GetLinenum()));
+                    }
+                    Exec(sl->left, reach);
+                }
+                return;
+
+            case IFNODE: {
+                if( !Activate(reach) )
+                    return;
+                Column c = Visit(t->left);
+                vector<char> inner(n, 0);
+                bool any = false;
+                for( size_t i = 0; i < n; i++ ) {
+                    if( !active[i] )
+                        continue;
+                    Value v = c.At(i);
+                    if( v.isBoolType() ) inner[i] = v.isTrue();
+                    else Fail(i, v.isFailure() ? v : Value::Failure("Need Boolean Type", t->left->GetLinenum()));
+                    any |= inner[i];
+                }
+                if( any )
+                    Exec(t->right, inner);
+                return;
+            }
+
+            case ASSIGNNODE: {
+                if( !Activate(reach) )
+                    return;
+                Column c = Assign(t);
+                for( size_t i = 0; i < n; i++ ) {
+                    if( active[i] && c.vals[i].isFailure() )
+                        Fail(i, c.vals[i]);
+                }
+                return;
+            }
+
+            case PRINTNODE: {
+                if( !Activate(reach) )
+                    return;
+                Column c = Visit(t->left);
+                vector<string> &col = cells[printIndex.at(t)];
+                for( size_t i = 0; i < n; i++ ) {
+                    if( !active[i] )
+                        continue;
+                    if( c.kind == Column::INTS ) {
+                        char buf[12];
+                        char *start = FormatInt(c.ints[i], buf + sizeof buf);
+                        col[i].assign(start, buf + sizeof buf - start);
+                    }
+                    else {
+                        Value v = c.At(i);
+                        if( v.isFailure() ) {
+                            Fail(i, v);
+                            continue;
+                        }
+                        ostringstream text;
+                        text << v;
+                        col[i] = text.str();
+                    }
+                    if( !evalBudget.Output(col[i].size() + 1) ) {
+                        col[i].clear();
+                        Fail(i, Value::Failure(evalBudget.exceeded, t->GetLinenum()));
+                    }
+                }
+                return;
+            }
+
+            // an expression statement is run for its assignments and its failures
+            default: {
+                if( !Activate(reach) )
+                    return;
+                Column c = Visit(t);
+                if( c.kind != Column::VALUES )
+                    return;
+                for( size_t i = 0; i < n; i++ ) {
+                    if( active[i] && c.vals[i].isFailure() )
+                        Fail(i, c.vals[i]);
+                }
+                return;
+            }
+        }
+    }
+};
+
+void SplitCsv(const string& line, vector<string>& fields, vector<char>& quoted)
+{
+    fields.clear();
+    quoted.clear();
+    size_t i = 0;
+    while( true ) {
+        string f;
+        bool q = false;
+        if( i < line.size() && line[i] == '"' ) {
+            q = true;
+            for( i++; i < line.size(); i++ ) {
+                if( line[i] == '"' ) {
+                    if( i + 1 < line.size() && line[i + 1] == '"' ) { f += '"'; i++; }
+                    else { i++; break; }
+                }
+                else {
+                    f += line[i];
+                }
+            }
+        }
+        while( i < line.size() && line[i] != ',' )
+            f += line[i++];
+        fields.push_back(std::move(f));
+        quoted.push_back(q);
+        if( i >= line.size() )
+            break;
+        i++;
+    }
+}
+
+// an empty or missing cell leaves its variable undefined for that record
+static Value ParseCell(const string& cell, bool quoted)
+{
+    if( quoted )
+        return Value(cell);
+    if( cell.empty() )
+        return Undefined();
+    if( cell == "True" || cell == "False" )
+        return Value(cell == "True");
+
+    int v;
+    auto res = std::from_chars(cell.data(), cell.data() + cell.size(), v);
+    if( res.ec == std::errc() && res.ptr == cell.data() + cell.size() )
+        return Value(v);
+    return Value(cell);
+}
+
+static void AppendCsv(string& out, const string& cell)
+{
+    if( cell.find_first_of(",\"\n") == string::npos ) {
+        out += cell;
+        return;
+    }
+    out += '"';
+    for( char c : cell ) {
+        if( c == '"' ) out += '"';
+        out += c;
+    }
+    out += '"';
+}
+
+long RunBatch(ParseTree *prog, const string& csvFile, const map<string, Value>& globals, ostream& out)
+{
+    ifstream in(csvFile);
+    if( !in.is_open() )
+        return -1;
+
+    string line;
+    vector<string> fields;
+    vector<char> quoted;
+    if( !getline(in, line) )
+        return -1;
+    if( line.size() && line.back() == '\r' ) line.pop_back();
+    SplitCsv(line, fields, quoted);
+    vector<const string*> names;
+    for( auto& f : fields )
+        names.push_back(Intern(f));
+
+    PrintFinder prints;
+    prints.Visit(prog);
+
+    string text;
+    for( size_t p = 0; p < prints.lines.size(); p++ )
+        text += "print@" + to_string(prints.lines[p]) + ",";
+    text += "error\n";
+    out << text;
+
+    BatchRunner runner(globals, prints.index, prints.lines.size());
+    vector<vector<Value>> cols(names.size());
+    long failed = 0;
+    bool more = true;
+    while( more ) {
+        for( auto& c : cols ) c.clear();
+        size_t n = 0;
+        while( n < BATCH && (more = bool(getline(in, line))) ) {
+            if( line.size() && line.back() == '\r' ) line.pop_back();
+            SplitCsv(line, fields, quoted);
+            for( size_t c = 0; c < names.size(); c++ )
+                cols[c].push_back(c < fields.size() ? ParseCell(fields[c], quoted[c]) : Undefined());
+            n++;
+        }
+        if( n == 0 )
+            break;
+
+        runner.Start(n);
+        for( size_t c = 0; c < names.size(); c++ ) {
+            Column col;
+            col.vals.swap(cols[c]);
+            col.Narrow();
+            runner.Bind(names[c], std::move(col));
+        }
+        runner.Exec(prog, vector<char>(n, 1));
+
+        text.clear();
+        for( size_t i = 0; i < n; i++ ) {
+            for( auto& col : runner.cells ) {
+                AppendCsv(text, col[i]);
+                text += ',';
+            }
+            const Value& err = runner.errors[i];
+            if( err.isFailure() ) {
+                AppendCsv(text, to_string(err.getErrorLine()) + ": RUNTIME ERROR " + err.getErrorText());
+                failed++;
+            }
+            text += '\n';
+        }
+        out << text;
+    }
+    return failed;
+}
@@ -0,0 +1,53 @@
+/*
+ * batch.h
+ */
+
+#ifndef BATCH_H_
+#define BATCH_H_
+
+#include <string>
+#include <iostream>
+#include "parsetree.h"
+using std::string;
+
+// Column holds one value per record of a batch. Int and bool columns keep raw ints
+// (bools as 0 or 1) so the operator kernels run over plain arrays; anything else,
+// including per-record failures, falls back to a vector of Values.
+struct Column {
+    enum Kind { INTS, BOOLS, VALUES } kind;
+    vector<int>		ints;
+    vector<Value>	vals;
+
+    Column() : kind(VALUES) {}
+    Column(Kind k, size_t n) : kind(k) {
+        if( k == VALUES ) vals.resize(n); else ints.resize(n);
+    }
+
+    size_t Size() const { return kind == VALUES ? vals.size() : ints.size(); }
+
+    Value At(size_t i) const {
+        if( kind == INTS ) return Value(ints[i]);
+        if( kind == BOOLS ) return Value(ints[i] != 0);
+        return vals[i];
+    }
+
+    // Narrow switches a VALUES column to INTS or BOOLS when every entry allows it
+    void Narrow();
+
+    // Widen switches to VALUES so that entries of any type can be stored
+    void Widen();
+};
+
+// RunBatch runs prog once per batch of records read from a CSV file. The header row
+// names the variables each column is bound to; cells that parse as ints or True/False
+// get those types and the rest are strings. Variables in globals, such as a loaded
+// snapshot, are visible to every record. Output is CSV too: one row per record with a
+// column for each print statement and a last column for the record's runtime error.
+// Returns the number of records that failed, or -1 if the input cannot be read.
+extern long RunBatch(ParseTree *prog, const string& csvFile, const map<string, Value>& globals, ostream& out);
+
+// SplitCsv breaks a line into fields, undoing quoting; quoted records a field that was
+// quoted, which always makes it a string
+extern void SplitCsv(const string& line, vector<string>& fields, vector<char>& quoted);
+
+#endif /* BATCH_H_ */
@@ -0,0 +1,63 @@
+#include <cstdio>
+#include "budget.h"
+
+thread_local Budget evalBudget;
+
+void Budget::Start()
+{
+    steps = 0;
+    output = 0;
+    exceeded.clear();
+    countdown = window = CHECKEVERY;
+    // a limit smaller than a window has to be checked exactly from the first step
+    if( maxSteps && maxSteps < (unsigned long)CHECKEVERY )
+        countdown = window = maxSteps + 1;
+    start = std::chrono::steady_clock::now();
+}
+
+// once a limit is hit every later check fails too, so the run unwinds quickly; the
+// window shrinks to one step so that every later Tick gets here
+bool Budget::Check()
+{
+    steps += window - countdown;
+    countdown = window = CHECKEVERY;
+
+    if( !exceeded.empty() ) {
+        countdown = window = 1;
+        return false;
+    }
+
+    if( maxSteps && steps > maxSteps ) {
+        exceeded = "step budget of " + std::to_string(maxSteps) + " exceeded";
+        countdown = window = 1;
+        return false;
+    }
+    if( maxSeconds > 0 ) {
+        std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+        if( took.count() > maxSeconds ) {
+            char secs[32];
+            snprintf(secs, sizeof secs, "%g", maxSeconds);
+            exceeded = string("time budget of ") + secs + " seconds exceeded";
+            countdown = window = 1;
+            return false;
+        }
+    }
+    // step limits smaller than a window are checked exactly
+    if( maxSteps && maxSteps - steps < (unsigned long)CHECKEVERY )
+        countdown = window = maxSteps - steps + 1;
+    return true;
+}
+
+bool Budget::Output(unsigned long bytes)
+{
+    output += bytes;
+    if( maxOutput && output > maxOutput ) {
+        if( exceeded.empty() ) {
+            exceeded = "output budget of " + std::to_string(maxOutput) + " bytes exceeded";
+            steps += window - countdown;
+            countdown = window = 1;
+        }
+        return false;
+    }
+    return true;
+}
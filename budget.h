@@ -0,0 +1,63 @@
+/*
+ * budget.h
+ */
+
+#ifndef BUDGET_H_
+#define BUDGET_H_
+
+#include <string>
+#include <chrono>
+using std::string;
+
+// Budget limits the work one run may do: evaluation steps, wall time and bytes printed.
+// Tick costs a decrement and a well predicted branch; the limits and the clock are only
+// looked at once every CHECKEVERY steps. A zero limit means unlimited.
+class Budget {
+    long	countdown;
+    long	window;			// the value countdown was last reset to
+    std::chrono::steady_clock::time_point	start;
+
+    bool Check();
+
+public:
+    static const long CHECKEVERY = 4096;
+
+    unsigned long	maxSteps = 0;
+    double			maxSeconds = 0;
+    unsigned long	maxOutput = 0;
+    unsigned long	maxString = 0;	// bytes in any one string a run builds
+
+    // strings are refused past MAXSTRING bytes even without a limit, rather than left
+    // to fail their allocation
+    static const unsigned long MAXSTRING = 1ul << 30;
+
+    unsigned long	steps = 0;		// steps charged before the current countdown
+    unsigned long	output = 0;
+    string			exceeded;		// the diagnostic once a limit has been hit
+
+    Budget() : countdown(CHECKEVERY), window(CHECKEVERY) {}
+
+    // reset the counters and start the clock for a new run
+    void Start();
+
+    bool Tick() { return --countdown > 0 || Check(); }
+
+    // Charge accounts for n steps of bulk work, such as copying during string repetition
+    bool Charge(unsigned long n) {
+        countdown -= (long)n;
+        return countdown > 0 || Check();
+    }
+
+    bool Output(unsigned long bytes);
+
+    unsigned long StringLimit() const {
+        return maxString && maxString < MAXSTRING ? maxString : MAXSTRING;
+    }
+
+    unsigned long Steps() const { return steps + window - countdown; }
+};
+
+// each thread runs its own interpreter, so each has its own budget
+extern thread_local Budget evalBudget;
+
+#endif /* BUDGET_H_ */
@@ -0,0 +1,178 @@
+#include <algorithm>
+#include "document.h"
+
+Document::Document(const string& text, int startLine) : text(text), startLine(startLine), reparsed(0)
+{
+    size_t at = 0;
+    int line = startLine;
+    do {
+        Piece p;
+        p.begin = at;
+        p.startLine = line;
+        at = NextCut(this->text, at);
+        Parse(p, at);
+        line += std::count(this->text.begin() + p.begin, this->text.begin() + at, '\n');
+        pieces.push_back(p);
+    } while( at < this->text.size() );
+
+    reparsed = pieces.size();
+    Link();
+}
+
+Document::~Document()
+{
+    // the pieces are linked into one list, which its head deletes
+    ParseTree *head = Tree();
+    delete head;
+}
+
+void Document::Parse(Piece& p, size_t end)
+{
+    p.result = ChunkResult();
+    ParseChunk(text.substr(p.begin, end - p.begin), p.startLine, &p.result);
+    p.tail = p.result.tree;
+    if( p.tail )
+        while( p.tail->right )
+            p.tail = p.tail->right;
+}
+
+// Link chains the pieces' statement lists into one list. The cached TreeStats of a list
+// node cover everything to its right, so nodes ahead of a changed link drop theirs.
+void Document::Link()
+{
+    ParseTree *next = 0;
+    bool changed = false;
+    for( size_t i = pieces.size(); i-- > 0; ) {
+        Piece& p = pieces[i];
+        if( p.result.tree == 0 )
+            continue;
+        if( p.tail->right != next ) {
+            p.tail->right = next;
+            changed = true;
+        }
+        if( changed ) {
+            for( ParseTree *sl = p.result.tree; sl; sl = sl->right ) {
+                sl->InvalidateStats();
+                if( sl == p.tail ) break;
+            }
+        }
+        next = p.result.tree;
+    }
+}
+
+ParseTree *Document::Tree() const
+{
+    for( const Piece& p : pieces ) {
+        if( p.result.tree )
+            return p.result.tree;
+    }
+    return 0;
+}
+
+bool Document::Failed() const
+{
+    for( const Piece& p : pieces ) {
+        if( p.result.errors )
+            return true;
+    }
+    return Tree() == 0;
+}
+
+// Prog stops at the first statement with an error, so only that piece's messages count
+string Document::Diagnostics() const
+{
+    bool any = false;
+    for( const Piece& p : pieces ) {
+        any |= p.result.tree != 0;
+        if( p.result.errors ) {
+            if( any )
+                return p.result.messages;
+            return p.result.messages + std::to_string(p.result.endLine) + ": No statements in program\n";
+        }
+    }
+    if( !any )
+        return std::to_string(pieces.back().result.endLine) + ": No statements in program\n";
+    return "";
+}
+
+bool Document::Edit(size_t offset, size_t len, const string& ins)
+{
+    if( offset > text.size() || len > text.size() - offset )
+        return false;
+
+    // the edit starts in the last piece that begins at or before offset
+    size_t first = 0;
+    while( first + 1 < pieces.size() && pieces[first + 1].begin <= offset )
+        first++;
+
+    long delta = (long)ins.size() - (long)len;
+    int lineDelta = std::count(ins.begin(), ins.end(), '\n')
+                    - std::count(text.begin() + offset, text.begin() + offset + len, '\n');
+    text.replace(offset, len, ins);
+
+    // cut the new text from the start of that piece until a cut past the edit falls where
+    // an old piece started; from there on the text, and so the parse, is unchanged
+    size_t editEnd = offset + ins.size();
+    size_t oldEnd = offset + len;
+    size_t keep = pieces.size();
+    vector<Piece> fresh;
+    size_t at = pieces[first].begin;
+    int line = pieces[first].startLine;
+    do {
+        Piece p;
+        p.begin = at;
+        p.startLine = line;
+        at = NextCut(text, at);
+        Parse(p, at);
+        line += std::count(text.begin() + p.begin, text.begin() + at, '\n');
+        fresh.push_back(p);
+
+        if( at >= editEnd && at < text.size() ) {
+            size_t old = at - delta;
+            auto it = std::lower_bound(pieces.begin() + first + 1, pieces.end(), old,
+                                       [](const Piece& q, size_t b) { return q.begin < b; });
+            if( it != pieces.end() && it->begin == old && old >= oldEnd ) {
+                keep = it - pieces.begin();
+                break;
+            }
+        }
+    } while( at < text.size() );
+
+    // unhook and free the replaced pieces; the kept ones are relinked below
+    for( size_t i = first; i < keep; i++ ) {
+        Piece& p = pieces[i];
+        if( p.result.tree ) {
+            p.tail->right = 0;
+            delete p.result.tree;
+        }
+    }
+
+    for( size_t i = keep; i < pieces.size(); i++ ) {
+        Piece& p = pieces[i];
+        p.begin += delta;
+        if( lineDelta == 0 )
+            continue;
+        p.startLine += lineDelta;
+        p.result.endLine += lineDelta;
+        if( p.result.errors ) {
+            // diagnostics are text with the line baked in, so rebuild them
+            if( p.result.tree ) {
+                p.tail->right = 0;
+                delete p.result.tree;
+            }
+            size_t end = i + 1 < pieces.size() ? pieces[i + 1].begin + delta : text.size();
+            Parse(p, end);
+            continue;
+        }
+        for( ParseTree *sl = p.result.tree; sl; sl = sl->right ) {
+            sl->left->ShiftLines(lineDelta);
+            if( sl == p.tail ) break;
+        }
+    }
+
+    reparsed = fresh.size();
+    pieces.erase(pieces.begin() + first, pieces.begin() + keep);
+    pieces.insert(pieces.begin() + first, fresh.begin(), fresh.end());
+    Link();
+    return true;
+}
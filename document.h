@@ -0,0 +1,64 @@
+/*
+ * document.h
+ */
+
+#ifndef DOCUMENT_H_
+#define DOCUMENT_H_
+
+#include <string>
+#include <vector>
+#include "parse.h"
+using std::string;
+using std::vector;
+
+// Document keeps a program's text together with its parse, split into pieces at the
+// statement boundaries NextCut finds. An edit re-lexes and re-parses from the piece it
+// starts in until the cuts line up with the old ones again; the statements after that
+// are kept, with their line numbers shifted if the edit added or removed lines. Trees
+// of kept statements, and the TreeStats cached on them, are reused as they are.
+//
+// Nodes hold absolute line numbers, so an edit that adds or removes lines walks every
+// node of every statement after it to shift them, and reparses the pieces after it
+// that have diagnostics. Edits that keep the line count only touch the pieces they
+// reparse, plus an offset update per later piece.
+class Document {
+public:
+    Document(const string& text, int startLine = 0);
+    ~Document();
+
+    // Edit replaces len bytes at offset with text. Returns false if the range is not
+    // inside the document. The fuzzer's edit mode checks every edit against a full parse.
+    bool Edit(size_t offset, size_t len, const string& text);
+
+    const string& Text() const { return text; }
+
+    // Tree is the statement list for the whole document, or 0 if there are no
+    // statements. It belongs to the document and changes with every edit.
+    ParseTree *Tree() const;
+
+    // Diagnostics is exactly what Prog would print for the current text
+    string Diagnostics() const;
+    bool Failed() const;
+
+    // the number of pieces the last edit parsed, and the number there are in all
+    size_t Reparsed() const { return reparsed; }
+    size_t Pieces() const { return pieces.size(); }
+
+private:
+    struct Piece {
+        size_t		begin;
+        int			startLine;
+        ChunkResult	result;
+        ParseTree	*tail;		// last StmtList node of result.tree
+    };
+
+    void Parse(Piece& p, size_t end);
+    void Link();
+
+    string			text;
+    int				startLine;
+    vector<Piece>	pieces;
+    size_t			reparsed;
+};
+
+#endif /* DOCUMENT_H_ */
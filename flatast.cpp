@@ -0,0 +1,232 @@
+#include "flatast.h"
+#include "visitor.h"
+
+int32_t FlatTree::StringIndex(const string *s)
+{
+    auto it = stringIndex.find(s);
+    if( it != stringIndex.end() )
+        return it->second;
+    strings.push_back(s);
+    return stringIndex[s] = strings.size() - 1;
+}
+
+// Flattener appends each subtree after its children and returns the new index
+class Flattener : public TreeVisitor<Flattener, uint32_t> {
+    FlatTree& ft;
+
+    uint32_t Child(ParseTree *t) { return t ? Visit(t) : FlatTree::NONE; }
+
+public:
+    Flattener(FlatTree& ft) : ft(ft) {}
+
+    uint32_t VisitNode(ParseTree *t) {
+        uint32_t l = Child(t->left);
+        uint32_t r = Child(t->right);
+        return ft.Add(t->GetKind(), t->GetLinenum(), l, r);
+    }
+    uint32_t VisitStmtList(StmtList *t) {
+        for( ParseTree *sl = t; sl; sl = sl->right )
+            ft.stmts.push_back( Visit(sl->left) );
+        return FlatTree::NONE;
+    }
+    // caching wrappers add nothing to a flat program
+    uint32_t VisitMemo(MemoExpr *t) { return Visit(t->left); }
+    uint32_t VisitIConst(IConst *t) {
+        return ft.Add(ICONSTNODE, t->GetLinenum(), FlatTree::NONE, FlatTree::NONE, t->getINTEGER());
+    }
+    uint32_t VisitBoolConst(BoolConst *t) {
+        return ft.Add(BCONSTNODE, t->GetLinenum(), FlatTree::NONE, FlatTree::NONE, t->getBOOLEAN());
+    }
+    uint32_t VisitSConst(SConst *t) {
+        return ft.Add(SCONSTNODE, t->GetLinenum(), FlatTree::NONE, FlatTree::NONE, ft.StringIndex(t->getSTRING()));
+    }
+    uint32_t VisitIdent(Ident *t) {
+        return ft.Add(IDENTNODE, t->GetLinenum(), FlatTree::NONE, FlatTree::NONE, ft.StringIndex(t->getSYMBOL()));
+    }
+};
+
+FlatTree *Flatten(ParseTree *prog)
+{
+    FlatTree *ft = new FlatTree;
+    Flattener f(*ft);
+    if( prog->GetKind() == LISTNODE )
+        f.Visit(prog);
+    else
+        ft->stmts.push_back( f.Visit(prog) );
+    return ft;
+}
+
+// FlatEvaluator mirrors the Eval methods in parsetree.h node for node, using a switch
+// on the kind array instead of virtual calls
+class FlatEvaluator {
+    const FlatTree& ft;
+    map<string, Value>& symbolMap;
+
+    Value Located(Value v, uint32_t n) const {
+        if( v.isFailure() && v.getErrorLine() == 0 ) { v.setErrorLine(ft.line[n]); }
+        return v;
+    }
+
+    // same fast path as EvalInt: only reads variables, false means use Eval
+    bool Int(uint32_t n, int &out) const {
+        int l, r;
+        switch( ft.kind[n] ) {
+            case ICONSTNODE:
+                out = ft.payload[n];
+                return true;
+            case IDENTNODE: {
+                auto it = symbolMap.find(*ft.strings[ft.payload[n]]);
+                if( it == symbolMap.end() || !it->second.isIntType() ) { return false; }
+                out = it->second.getInteger();
+                return true;
+            }
+            case PLUSNODE:
+            case MINUSNODE:
+            case TIMESNODE:
+            case DIVIDENODE:
+                if( !Int(ft.lhs[n], l) || !Int(ft.rhs[n], r) ) { return false; }
+                switch( ft.kind[n] ) {
+                    case PLUSNODE:	out = l + r; return true;
+                    case MINUSNODE:	out = l - r; return true;
+                    case TIMESNODE:	out = l * r; return true;
+                    default:
+                        if( r == 0 ) { return false; }
+                        out = Quotient(l, r);
+                        return true;
+                }
+            default:
+                return false;
+        }
+    }
+
+    Value Compare(uint32_t n) {
+        int li, ri;
+        NodeKind k = (NodeKind)ft.kind[n];
+        bool leftInt = Int(ft.lhs[n], li);
+        if( leftInt && Int(ft.rhs[n], ri) ) {
+            switch( k ) {
+                case EQNODE:	return Value(li == ri);
+                case NEQNODE:	return Value(li != ri);
+                case LTNODE:	return Value(li < ri);
+                case LEQNODE:	return Value(li <= ri);
+                case GTNODE:	return Value(li > ri);
+                default:		return Value(li >= ri);
+            }
+        }
+
+        // reuse the left int rather than evaluating the operand again
+        Value l = leftInt ? Value(li) : Eval(ft.lhs[n]);
+        if( l.isFailure() ) { return l; }
+        Value r = Eval(ft.rhs[n]);
+        switch( k ) {
+            case EQNODE:	return Located(l == r, n);
+            case NEQNODE:	return Located(l != r, n);
+            case LTNODE:	return Located(l < r, n);
+            case LEQNODE:	return Located(l <= r, n);
+            case GTNODE:	return Located(l > r, n);
+            default:		return Located(l >= r, n);
+        }
+    }
+
+public:
+    FlatEvaluator(const FlatTree& ft, map<string, Value>& symbolMap) : ft(ft), symbolMap(symbolMap) {}
+
+    Value Eval(uint32_t n) {
+        switch( ft.kind[n] ) {
+            case IFNODE: {
+                uint32_t c = ft.lhs[n];
+                Value cond = Eval(c);
+                if( cond.isBoolType() ) {
+                    if( cond.isTrue() ) { return Eval(ft.rhs[n]); }
+                    return Value();
+                }
+                if( cond.isFailure() ) { return cond; }
+                return Value::Failure("Need Boolean Type", ft.line[c]);
+            }
+
+            case ASSIGNNODE: {
+                uint32_t id = ft.lhs[n];
+                if( ft.kind[id] != IDENTNODE ) { return Value::Failure("IDENT Type Expected", ft.line[n]); }
+                Value v = Eval(ft.rhs[n]);
+                if( v.isFailure() ) { return v; }
+                symbolMap[*ft.strings[ft.payload[id]]] = v;
+                return Value();
+            }
+
+            case PRINTNODE: {
+                Value v = Eval(ft.lhs[n]);
+                if( v.isFailure() ) { return v; }
+                if( !evalBudget.Output(v.PrintedSize() + 1) ) { return Value::Failure(evalBudget.exceeded, ft.line[n]); }
+                *printOut << v << '\n';
+                return Value();
+            }
+
+            case PLUSNODE:
+            case MINUSNODE:
+            case TIMESNODE:
+            case DIVIDENODE: {
+                Value l = Eval(ft.lhs[n]);
+                if( l.isFailure() ) { return l; }
+                Value r = Eval(ft.rhs[n]);
+                switch( ft.kind[n] ) {
+                    case PLUSNODE:	return Located(l + r, n);
+                    case MINUSNODE:	return Located(l - r, n);
+                    case TIMESNODE:	return Located(l * r, n);
+                    default:		return Located(l / r, n);
+                }
+            }
+
+            case ANDNODE: {
+                Value l = Eval(ft.lhs[n]);
+                if( l.isFailure() ) { return l; }
+                Value r = Eval(ft.rhs[n]);
+                if( r.isFailure() ) { return r; }
+                if( l.isBoolType() && r.isBoolType() ) { return Value(l.isTrue() && r.isTrue()); }
+                return Value::Failure("BOOL Type expected", ft.line[n]);
+            }
+
+            case ORNODE: {
+                Value r = Eval(ft.rhs[n]);
+                if( r.isFailure() ) { return r; }
+                Value l = Eval(ft.lhs[n]);
+                if( l.isFailure() ) { return l; }
+                if( l.isBoolType() || r.isBoolType() ) { return Value(l.isTrue() || r.isTrue()); }
+                return Value::Failure("BOOL Type Expected", ft.line[n]);
+            }
+
+            case EQNODE:
+            case NEQNODE:
+            case LTNODE:
+            case LEQNODE:
+            case GTNODE:
+            case GEQNODE:
+                return Compare(n);
+
+            case ICONSTNODE:
+                return Value((int)ft.payload[n]);
+            case BCONSTNODE:
+                return Value(ft.payload[n] != 0);
+            case SCONSTNODE:
+                return Value(*ft.strings[ft.payload[n]]);
+            case IDENTNODE: {
+                auto it = symbolMap.find(*ft.strings[ft.payload[n]]);
+                if( it != symbolMap.end() ) { return it->second; }
+                return Value::Failure("", ft.line[n]);
+            }
+
+            default:
+                return Value();
+        }
+    }
+};
+
+Value FlatEval(const FlatTree& ft, map<string, Value> &symbolMap)
+{
+    FlatEvaluator ev(ft, symbolMap);
+    for( uint32_t s : ft.stmts ) {
+        if( !evalBudget.Tick() ) { return Value::Failure(evalBudget.exceeded, ft.line[s]); }
+        Value v = ev.Eval(s);
+        if( v.isFailure() ) { return v; }
+    }
+    return Value();
+}
@@ -0,0 +1,59 @@
+/*
+ * flatast.h
+ */
+
+#ifndef FLATAST_H_
+#define FLATAST_H_
+
+#include <cstdint>
+#include "parsetree.h"
+
+// FlatTree is a compact encoding of a program: one entry per node in parallel arrays,
+// children referenced by 32-bit index. Nodes are stored children-first, so walking an
+// expression moves forward through memory. The payload holds an int or bool constant
+// inline, or an index into strings for string constants and identifier names.
+class FlatTree {
+public:
+    static const uint32_t NONE = 0xFFFFFFFF;
+
+    vector<uint8_t>		kind;
+    vector<int32_t>		line;
+    vector<uint32_t>	lhs;
+    vector<uint32_t>	rhs;
+    vector<int32_t>		payload;
+    vector<const string*>	strings;	// interned, so equal strings share an entry
+    vector<uint32_t>	stmts;		// top-level statements in program order
+
+    uint32_t Add(NodeKind k, int ln, uint32_t l = NONE, uint32_t r = NONE, int32_t p = 0) {
+        kind.push_back(k);
+        line.push_back(ln);
+        lhs.push_back(l);
+        rhs.push_back(r);
+        payload.push_back(p);
+        return kind.size() - 1;
+    }
+
+    int32_t StringIndex(const string *s);
+
+    size_t Size() const { return kind.size(); }
+
+    // bytes used by the node arrays, not counting the shared string pool
+    size_t Bytes() const {
+        return kind.capacity() * sizeof(uint8_t) + line.capacity() * sizeof(int32_t)
+               + lhs.capacity() * sizeof(uint32_t) + rhs.capacity() * sizeof(uint32_t)
+               + payload.capacity() * sizeof(int32_t) + strings.capacity() * sizeof(const string*)
+               + stmts.capacity() * sizeof(uint32_t);
+    }
+
+private:
+    map<const string*, int32_t>	stringIndex;
+};
+
+// Flatten encodes a parsed program; the pointer tree can be deleted afterwards
+extern FlatTree *Flatten(ParseTree *prog);
+
+// FlatEval runs the statements of a flat program with the same semantics as
+// ParseTree::Eval, returning the first failure if there is one
+extern Value FlatEval(const FlatTree& ft, map<string, Value> &symbolMap);
+
+#endif /* FLATAST_H_ */
@@ -0,0 +1,762 @@
+#include <random>
+#include <sstream>
+#include <fstream>
+#include <chrono>
+#include <map>
+#include <cstdio>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "fuzz.h"
+#include "parse.h"
+#include "flatast.h"
+#include "passes.h"
+#include "batch.h"
+#include "transpile.h"
+#include "server.h"
+#include "document.h"
+#include "repl.h"
+#include "profile.h"
+#include "snapshot.h"
+
+const char *WorkloadName(Workload w)
+{
+    static const char *names[NUMWORKLOADS] = { "arith", "strings", "branches", "mixed" };
+    return names[w];
+}
+
+// ProgramGen writes random statements for the grammar in parse.cpp. It tracks which
+// variables hold which type so most programs run to completion, and it always puts
+// spaces around operators since "a -1" would lex as an identifier and a constant.
+class ProgramGen {
+    std::mt19937	rng;
+    Workload		work;
+    bool			errors;		// allow statements that fail at run time
+    vector<string>	ints, strs, bools;	// variables assigned so far, by type
+    std::ostringstream	out;
+
+    int Pick(int n) { return std::uniform_int_distribution<int>(0, n - 1)(rng); }
+    bool Chance(int percent) { return Pick(100) < percent; }
+
+    // only unconditional assignments (depth 0) make a new variable readable later
+    string Name(vector<string>& pool, const char *prefix, int depth) {
+        if( pool.size() < 6 && (pool.empty() || Chance(30)) ) {
+            string name = prefix + std::to_string(pool.size());
+            if( depth == 0 )
+                pool.push_back(name);
+            return name;
+        }
+        return pool[Pick(pool.size())];
+    }
+
+    string Var(vector<string>& pool, const string& fallback) {
+        if( errors && Pick(1000) == 0 )
+            return "undefined" + std::to_string(Pick(3));
+        return pool.empty() ? fallback : pool[Pick(pool.size())];
+    }
+
+    string IntExpr(int depth) {
+        if( depth <= 0 || Chance(30) ) {
+            if( Chance(50) )
+                return std::to_string(Pick(41) - 20);
+            return Var(ints, std::to_string(Pick(10)));
+        }
+        switch( Pick(6) ) {
+            case 0: return IntExpr(depth - 1) + " + " + IntExpr(depth - 1);
+            case 1: return IntExpr(depth - 1) + " - " + IntExpr(depth - 1);
+            case 2: return IntExpr(depth - 1) + " * " + IntExpr(depth - 1);
+            case 3: return IntExpr(depth - 1) + " / " + (errors && Chance(2) ? Var(ints, "0") : std::to_string(Pick(9) + 1));
+            case 4: return "-" + string(Chance(50) ? " " : "") + "(" + IntExpr(depth - 1) + ")";
+            default: return "(" + IntExpr(depth - 1) + ")";
+        }
+    }
+
+    string StrConst() {
+        static const char *words[] = { "a", "bc", "x y", "semi;colon", "hash#", "", "Zz" };
+        return string("\"") + words[Pick(7)] + "\"";
+    }
+
+    // repetition is only applied to constants so strings cannot grow without bound
+    string StrExpr(int depth) {
+        if( depth <= 0 || Chance(30) )
+            return Chance(50) ? StrConst() : Var(strs, StrConst());
+        switch( Pick(4) ) {
+            case 0: return Var(strs, StrConst()) + " + " + StrConst();
+            case 1: return StrConst() + " * " + std::to_string(Pick(4));
+            case 2: return std::to_string(Pick(4)) + " * " + StrConst();
+            default: return errors && Chance(2) ? IntExpr(1) + " + " + StrConst() : StrConst() + " + " + StrConst();
+        }
+    }
+
+    string BoolExpr(int depth) {
+        // the lexer has no != even though the parser knows NEQ
+        static const char *cmps[] = { " == ", " < ", " <= ", " > ", " >= " };
+        if( depth <= 0 || Chance(20) )
+            return Chance(50) ? (Chance(50) ? "true" : "false") : Var(bools, "true");
+        switch( Pick(5) ) {
+            case 0:
+            case 1: return IntExpr(depth - 1) + cmps[Pick(5)] + IntExpr(depth - 1);
+            case 2: return StrExpr(depth - 1) + cmps[Pick(5)] + StrExpr(depth - 1);
+            case 3: return "(" + BoolExpr(depth - 1) + ") && (" + BoolExpr(depth - 1) + ")";
+            default: return "(" + BoolExpr(depth - 1) + ") || (" + BoolExpr(depth - 1) + ")";
+        }
+    }
+
+    string Stmt(int depth) {
+        int weights[NUMWORKLOADS][5] = {
+            // int assign, str assign, bool assign, print, if
+            { 50, 0, 5, 35, 10 },
+            { 10, 45, 5, 35, 5 },
+            { 20, 5, 15, 20, 40 },
+            { 25, 20, 10, 25, 20 },
+        };
+        int *w = weights[work];
+        int r = Pick(100);
+        if( depth > 2 )
+            r = Pick(100 - w[4]);
+
+        if( (r -= w[0]) < 0 )
+            return Name(ints, "i", depth) + " = " + IntExpr(3);
+        if( (r -= w[1]) < 0 )
+            return Name(strs, "s", depth) + " = " + StrExpr(2);
+        if( (r -= w[2]) < 0 )
+            return Name(bools, "b", depth) + " = " + BoolExpr(2);
+        if( (r -= w[3]) < 0 ) {
+            switch( Pick(3) ) {
+                case 0: return "print " + IntExpr(3);
+                case 1: return "print " + StrExpr(2);
+                default: return "print " + BoolExpr(2);
+            }
+        }
+        return "if " + BoolExpr(2) + " then " + Stmt(depth + 1);
+    }
+
+public:
+    ProgramGen(unsigned seed, Workload w, bool errors) : rng(seed), work(w), errors(errors) {}
+
+    string Program(int nstmts) {
+        for( int i = 0; i < nstmts; i++ ) {
+            out << Stmt(0) << ";";
+            if( Chance(5) )
+                out << " # " << Pick(1000);
+            out << (Chance(80) ? "\n" : " ");
+        }
+        return out.str();
+    }
+};
+
+string RandomProgram(unsigned seed, Workload w, int nstmts, bool errors)
+{
+    return ProgramGen(seed, w, errors).Program(nstmts);
+}
+
+enum Mode { TREE, PARALLEL, PIPE, FLAT, JIT, MEMO, DCE, CSE, BATCH, CPP, SERVER, REPL, PROFILE, SNAPSHOT, EDIT,
+            NUMMODES };
+static const char *modeNames[NUMMODES] = { "tree", "parallel", "pipe", "flat", "jit", "memo", "dce", "cse",
+                                           "batch", "emit-cpp", "server", "repl", "profile", "snapshot",
+                                           "edit" };
+
+// Scratch is what the modes that leave the process need: a directory for the batch
+// input and the generated C++, the object for the budget code that C++ links against,
+// and a server running in a child process. A mode whose setup fails says so once and
+// is left out.
+class Scratch {
+public:
+    string	dir;
+    string	cxx;
+    string	src;
+    bool	cpp = false;
+    pid_t	server = -1;
+
+    Scratch() {
+        char tmpl[] = "/tmp/fuzz-XXXXXX";
+        if( mkdtemp(tmpl) == 0 ) {
+            cerr << "COULD NOT MAKE A SCRATCH DIRECTORY; batch, emit-cpp, server and snapshot modes skipped" << endl;
+            return;
+        }
+        dir = tmpl;
+        std::ofstream(dir + "/records.csv") << "fuzzrecord\n1\n2\n3\n";
+
+        cxx = getenv("CXX") ? getenv("CXX") : "g++";
+        src = getenv("FUZZ_SRC") ? getenv("FUZZ_SRC") : ".";
+        cpp = system((cxx + " -std=c++17 -O0 -c " + src + "/budget.cpp -o " + dir + "/budget.o"
+                      + " 2>/dev/null").c_str()) == 0;
+        if( !cpp )
+            cerr << "COULD NOT BUILD " << src << "/budget.cpp WITH " << cxx
+                 << "; emit-cpp mode skipped (FUZZ_SRC names the source directory)" << endl;
+
+        string path = dir + "/server.sock";
+        cout.flush();
+        cerr.flush();
+        server = fork();
+        if( server == 0 ) {
+            // the server's latency report would only clutter the fuzzer's
+            int null = open("/dev/null", O_WRONLY);
+            dup2(null, 2);
+            _exit(RunServer(path, 2, Budget()) == 0 ? 0 : 1);
+        }
+        struct stat st;
+        for( int wait = 0; server > 0 && wait < 500; wait++ ) {
+            if( stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode) )
+                return;
+            usleep(10000);
+        }
+        cerr << "SERVER DID NOT START; server mode skipped" << endl;
+        Stop();
+    }
+
+    ~Scratch() {
+        Stop();
+        if( dir.size() )
+            system(("rm -rf " + dir).c_str());
+    }
+
+    void Stop() {
+        if( server > 0 ) {
+            kill(server, SIGTERM);
+            waitpid(server, 0, 0);
+        }
+        server = -1;
+    }
+
+    bool Has(int mode) const {
+        if( mode == BATCH || mode == SNAPSHOT ) return dir.size() > 0;
+        if( mode == CPP ) return cpp;
+        if( mode == SERVER ) return server > 0;
+        return true;
+    }
+};
+
+// Nodes walks every node once, shared ones included
+static vector<ParseTree*> Nodes(ParseTree *root)
+{
+    vector<ParseTree*> all;
+    set<ParseTree*> seen;
+    vector<ParseTree*> work(1, root);
+    while( !work.empty() ) {
+        ParseTree *t = work.back();
+        work.pop_back();
+        if( t == 0 || !seen.insert(t).second )
+            continue;
+        all.push_back(t);
+        work.push_back(t->right);
+        work.push_back(t->left);
+    }
+    return all;
+}
+
+// StatsCurrent is false if a pass changed a subtree without dropping the counts
+// cached above it
+static bool StatsCurrent(ParseTree *root)
+{
+    for( ParseTree *t : Nodes(root) )
+        if( !(t->Stats() == t->Count()) )
+            return false;
+    return true;
+}
+
+// Records turns batch output back into what the tree walker prints: a record's cells in
+// column order, which is the order its prints ran in since there are no loops, then its
+// error. Every record has to come out the same.
+static string Records(const string& csv)
+{
+    istringstream in(csv);
+    string line, first, text;
+    vector<string> fields;
+    vector<char> quoted;
+    getline(in, line);
+    for( int record = 0; getline(in, line); record++ ) {
+        SplitCsv(line, fields, quoted);
+        text.clear();
+        for( auto& f : fields ) {
+            if( f.size() )
+                text += f + "\n";
+        }
+        if( record == 0 )
+            first = text;
+        else if( text != first )
+            return first + "BATCH RECORDS DIFFER\n";
+    }
+    return first;
+}
+
+// an empty cell cannot be told from a print that did not run, so the batch comparison
+// leaves out empty lines on both sides
+static string DropEmpty(const string& text)
+{
+    istringstream in(text);
+    string line, out;
+    while( getline(in, line) ) {
+        if( line.size() )
+            out += line + "\n";
+    }
+    return out;
+}
+
+// Table lists a symbol table's variables with their types and values; failures are
+// never saved, so they are left out
+static string Table(const map<string, Value>& symbols)
+{
+    std::ostringstream out;
+    for( auto& s : symbols ) {
+        const Value& v = s.second;
+        if( v.isFailure() )
+            continue;
+        char type = v.isIntType() ? 'i' : v.isStringType() ? 's' : v.isBoolType() ? 'b' : 'e';
+        out << s.first << " " << type << " " << v << "\n";
+    }
+    return out.str();
+}
+
+// RunMode parses a program and runs it twice against the same symbol table (so caches
+// and compiled code get exercised), returning everything written to cout. In batch mode
+// the second run is the records of a batch, which start from what the first run left;
+// in snapshot mode the table is saved, cleared and loaded again between the runs.
+static string RunMode(const string& text, Mode mode, const Scratch& scratch, int runs = 2)
+{
+    std::ostringstream out;
+    std::streambuf *saved = cout.rdbuf(out.rdbuf());
+
+    map<string, Value> symbols;
+    currentPool->NewGeneration();
+    istringstream in(text);
+    int line = 0;
+
+    ParseTree *prog;
+    if( mode == PARALLEL )
+        prog = ParallelProg(&in, &line, 8, 1);
+    else if( mode == PIPE )
+        prog = PipelinedProg(&in, &line);
+    else
+        prog = Prog(&in, &line);
+
+    // every node caches its counts before a pass rewrites the tree
+    bool pass = mode == DCE || mode == CSE || mode == MEMO;
+    if( prog && pass ) {
+        for( ParseTree *t : Nodes(prog) )
+            t->Stats();
+    }
+
+    if( prog ) {
+        if( mode == DCE ) {
+            DeadCodePass dce;
+            dce.Run(prog);
+        }
+        if( mode == CSE ) {
+            CsePass cse;
+            cse.Run(prog);
+        }
+        FlatTree *ft = 0;
+        if( mode == FLAT )
+            ft = Flatten(prog);
+        if( mode == MEMO ) {
+            MemoizePass memo;
+            memo.Run(prog);
+        }
+        if( pass && prog && !StatsCurrent(prog) )
+            cout << "STALE TREE STATS AFTER " << modeNames[mode] << endl;
+        bool savedJit = jitEnabled;
+        unsigned savedThreshold = jitThreshold;
+        if( mode == JIT ) {
+            jitEnabled = true;
+            jitThreshold = 1;
+        }
+        if( mode == PROFILE && !profiler.Start() )
+            cout << "COULD NOT START THE PROFILER" << endl;
+
+        for( int run = 0; run < runs; run++ ) {
+            if( mode == SNAPSHOT && run == 1 ) {
+                // the second run mostly assigns before it reads, so the table is also
+                // compared directly
+                string snap = scratch.dir + "/fuzz.snap";
+                string before = Table(symbols);
+                if( !SaveSnapshot(snap, symbols) )
+                    cout << "COULD NOT SAVE SNAPSHOT" << endl;
+                symbols.clear();
+                if( !LoadSnapshot(snap, symbols) )
+                    cout << "COULD NOT LOAD SNAPSHOT" << endl;
+                if( Table(symbols) != before )
+                    cout << "SNAPSHOT CHANGED THE TABLE" << endl;
+            }
+            if( mode == BATCH && run == 1 ) {
+                std::ostringstream csv;
+                evalBudget.Start();
+                if( RunBatch(prog, scratch.dir + "/records.csv", symbols, csv) < 0 )
+                    cout << "COULD NOT READ BATCH INPUT" << endl;
+                cout << Records(csv.str());
+                break;
+            }
+            Value result = ft ? FlatEval(*ft, symbols)
+                         : mode == PROFILE ? profiler.Eval(prog, symbols) : prog->Eval(symbols);
+            if( result.isFailure() )
+                cout << result.getErrorLine() << ": RUNTIME ERROR " << result.getErrorText() << endl;
+        }
+
+        if( mode == PROFILE )
+            profiler.Stop();
+        jitEnabled = savedJit;
+        jitThreshold = savedThreshold;
+        delete ft;
+        delete prog;
+    }
+
+    cout.rdbuf(saved);
+    return out.str();
+}
+
+// RunCpp transpiles a program, builds it and returns what it prints in its one run
+static string RunCpp(const string& text, const Scratch& scratch)
+{
+    istringstream in(text);
+    int line = 0;
+    ParseTree *prog = Prog(&in, &line);
+    if( prog == 0 )
+        return "";
+    {
+        std::ofstream cpp(scratch.dir + "/prog.cpp");
+        EmitCpp(prog, "fuzz", cpp);
+    }
+    delete prog;
+
+    string exe = scratch.dir + "/prog";
+    // -Wall catches unused helpers in the prelude; comparing a variable with itself is
+    // the script's doing, not the transpiler's
+    string build = scratch.cxx + " -std=c++17 -O0 -Wall -Wno-tautological-compare -Werror -I" + scratch.src
+                   + " " + exe + ".cpp " + scratch.dir + "/budget.o -o " + exe;
+    if( system(build.c_str()) != 0 )
+        return "GENERATED C++ DID NOT BUILD\n";
+
+    string out;
+    FILE *p = popen((exe + " -lines").c_str(), "r");
+    if( p == 0 )
+        return "GENERATED PROGRAM DID NOT RUN\n";
+    char buf[4096];
+    size_t n;
+    while( (n = fread(buf, 1, sizeof buf, p)) > 0 )
+        out.append(buf, n);
+    pclose(p);
+    return out;
+}
+
+// RunRepl feeds a program to the interactive loop on a fresh table. The loop carries on
+// past a runtime error where a script stops, so only its output up to the first one
+// is returned.
+static string RunRepl(const string& text)
+{
+    std::ostringstream out;
+    std::streambuf *saved = cout.rdbuf(out.rdbuf());
+    map<string, Value> symbols;
+    currentPool->NewGeneration();
+    istringstream in(text);
+    int line = 0;
+    Repl(&in, &line, symbols, false);
+    cout.rdbuf(saved);
+
+    string result = out.str();
+    size_t error = result.find(": RUNTIME ERROR ");
+    if( error != string::npos )
+        result.erase(result.find('\n', error) + 1);
+    return result;
+}
+
+// RunServed sends a program to the scratch server and returns its output
+static string RunServed(const string& text, const Scratch& scratch)
+{
+    std::ostringstream out;
+    std::streambuf *saved = cout.rdbuf(out.rdbuf());
+    istringstream in(text);
+    int status = RunClient(scratch.dir + "/server.sock", &in);
+    cout.rdbuf(saved);
+    return status < 0 ? "SERVER DID NOT ANSWER\n" : out.str();
+}
+
+// Walk runs a parsed program once on a fresh table and returns what it prints
+static string Walk(ParseTree *prog)
+{
+    std::ostringstream out;
+    std::streambuf *saved = cout.rdbuf(out.rdbuf());
+    map<string, Value> symbols;
+    currentPool->NewGeneration();
+    Value result = prog->Eval(symbols);
+    if( result.isFailure() )
+        cout << result.getErrorLine() << ": RUNTIME ERROR " << result.getErrorText() << endl;
+    cout.rdbuf(saved);
+    return out.str();
+}
+
+// Shape lists the kind and line of every node, so two parses can be compared
+static string Shape(ParseTree *prog)
+{
+    string shape;
+    for( ParseTree *t : Nodes(prog) )
+        shape += std::to_string(t->GetKind()) + ":" + std::to_string(t->GetLinenum()) + " ";
+    return shape + "\n";
+}
+
+// Reparse is what a full parse of text prints, followed by the shape of its tree and
+// what the program prints
+static string Reparse(const string& text)
+{
+    std::ostringstream out;
+    std::streambuf *saved = cout.rdbuf(out.rdbuf());
+    istringstream in(text);
+    int line = 0;
+    ParseTree *prog = Prog(&in, &line);
+    cout.rdbuf(saved);
+    string result = out.str();
+    if( prog )
+        result += Shape(prog) + Walk(prog);
+    delete prog;
+    return result;
+}
+
+// EditsAgree applies a sequence of random edits, seeded from text, to a Document holding
+// text. After every edit the document's diagnostics, tree and output have to match a
+// full parse of the edited text, and the counts cached on kept statements have to be
+// current. Most edits insert, delete or replace whole lines of the program, so it
+// keeps running; the rest break a statement apart and are then undone.
+static bool EditsAgree(const string& text)
+{
+    static const char *fragments[] = { ";", "\n", "print ", "if ", " then ", "\"", "#", "(", "x = 1;\n", " + " };
+    std::mt19937 rng(std::hash<string>()(text));
+    auto pick = [&rng](size_t n) { return std::uniform_int_distribution<size_t>(0, n - 1)(rng); };
+
+    vector<string> lines;
+    istringstream in(text);
+    for( string line; getline(in, line); )
+        lines.push_back(line + "\n");
+
+    Document doc(text);
+    auto agrees = [&doc](int edit) {
+        string got = doc.Diagnostics();
+        ParseTree *tree = doc.Failed() ? 0 : doc.Tree();
+        if( tree ) {
+            if( !StatsCurrent(tree) )
+                got += "STALE TREE STATS\n";
+            got += Shape(tree) + Walk(tree);
+        }
+        if( got == Reparse(doc.Text()) )
+            return true;
+        cerr << "DOCUMENT DISAGREES WITH A FULL PARSE AFTER EDIT " << edit << endl;
+        return false;
+    };
+
+    for( int edit = 0; edit < 20; edit++ ) {
+        const string& cur = doc.Text();
+        vector<size_t> starts(1, 0);
+        for( size_t i = 0; i < cur.size(); i++ ) {
+            if( cur[i] == '\n' && i + 1 < cur.size() )
+                starts.push_back(i + 1);
+        }
+        size_t at = starts[pick(starts.size())];
+        size_t lineEnd = cur.find('\n', at);
+        size_t lineLen = (lineEnd == string::npos ? cur.size() : lineEnd + 1) - at;
+
+        int kind = pick(4);
+        if( kind == 3 ) {
+            // break a statement, then put it back
+            string frag = fragments[pick(sizeof fragments / sizeof fragments[0])];
+            size_t offset = pick(cur.size() + 1);
+            doc.Edit(offset, 0, frag);
+            if( !agrees(edit) )
+                return false;
+            doc.Edit(offset, frag.size(), "");
+        }
+        else if( kind == 2 || lines.empty() )
+            doc.Edit(at, lineLen, "");
+        else
+            doc.Edit(at, kind == 1 ? lineLen : 0, lines[pick(lines.size())]);
+        if( !agrees(edit) )
+            return false;
+    }
+    return true;
+}
+
+// Disagreement returns the first mode whose output differs from the tree walker's for
+// text, or NUMMODES if they all agree
+static int Disagreement(const string& text, const Scratch& scratch)
+{
+    // the generated program, the server and the interactive loop run a script once, on
+    // a fresh table
+    string expect = RunMode(text, TREE, scratch);
+    string once = RunMode(text, TREE, scratch, 1);
+    for( int m = TREE + 1; m < NUMMODES; m++ ) {
+        if( !scratch.Has(m) )
+            continue;
+        bool same;
+        if( m == BATCH )
+            same = DropEmpty(RunMode(text, BATCH, scratch)) == DropEmpty(expect);
+        else if( m == CPP )
+            same = RunCpp(text, scratch) == once;
+        else if( m == SERVER )
+            same = RunServed(text, scratch) == once;
+        else if( m == REPL )
+            same = RunRepl(text) == once;
+        else if( m == EDIT )
+            same = EditsAgree(text);
+        else
+            same = RunMode(text, Mode(m), scratch) == expect;
+        if( !same )
+            return m;
+    }
+    return NUMMODES;
+}
+
+// programs that once made a mode disagree with the tree walker; they run before the
+// random ones
+static const char *regressions[] = {
+    // dce took y = x - 1 for an int subtraction that cannot fail and dropped it
+    "x = 1; print (x = \"s\"); y = x - 1; print \"done\";\n",
+    // INT_MIN / -1 trapped, which took the whole server down with it
+    "z = -2147483647 - 1; print z / -1; w = z / -1; print w; d = -1; print z / d; print (z / d) / d;\n",
+    // batch mode skipped expression statements, so it never saw this failure
+    "print 1; 1 / 0; print 2;\n",
+    // snapshots dropped a variable holding the empty Value an assignment evaluates to
+    "a = 1; e = (b = 2); print e; print a;\n",
+};
+
+int RunFuzz(int count, unsigned seed)
+{
+    Scratch scratch;
+    int mismatches = 0;
+    int nregressions = sizeof regressions / sizeof regressions[0];
+    for( int i = 0; i < nregressions; i++ ) {
+        int m = Disagreement(regressions[i], scratch);
+        if( m == NUMMODES )
+            continue;
+        cerr << "MISMATCH in regression " << i << " in mode " << modeNames[m] << ":\n" << regressions[i];
+        mismatches++;
+    }
+
+    for( int i = 0; i < count; i++ ) {
+        unsigned s = seed + i;
+        Workload w = Workload(i % NUMWORKLOADS);
+        string text = RandomProgram(s, w, 40);
+        int m = Disagreement(text, scratch);
+        if( m == NUMMODES )
+            continue;
+
+        string saveAs = "fuzz-" + std::to_string(s) + ".txt";
+        std::ofstream(saveAs) << text;
+        cerr << "MISMATCH seed " << s << " (" << WorkloadName(w) << ") in mode "
+             << modeNames[m] << ", program saved to " << saveAs << endl;
+        mismatches++;
+    }
+    cerr << count << " programs and " << nregressions << " regressions, " << mismatches << " mismatches" << endl;
+    return mismatches;
+}
+
+// Throughput is statements per second for parsing and running a program, best of five
+static double Throughput(const string& text, int nstmts)
+{
+    double best = 0;
+    for( int rep = 0; rep < 5; rep++ ) {
+        std::ostringstream sink;
+        std::streambuf *saved = cout.rdbuf(sink.rdbuf());
+        auto start = std::chrono::steady_clock::now();
+
+        map<string, Value> symbols;
+        istringstream in(text);
+        int line = 0;
+        ParseTree *prog = Prog(&in, &line);
+        if( prog )
+            prog->Eval(symbols);
+        delete prog;
+
+        std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+        cout.rdbuf(saved);
+        best = max(best, nstmts / took.count());
+    }
+    return best;
+}
+
+// Reference is iterations per second, best of five, of a native loop doing the kind of
+// work a statement does: a map lookup by name, some arithmetic and a string append.
+// Workloads are scored against it, so the baseline does not depend on the machine.
+static double Reference()
+{
+    static const char *names[] = { "i0", "i1", "s0", "s1", "b0", "b1", "i2", "s2" };
+    const int iters = 200000;
+    double best = 0;
+    for( int rep = 0; rep < 5; rep++ ) {
+        map<string, long> vars;
+        for( const char *n : names )
+            vars[n] = 0;
+        string s;
+        long sum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for( int i = 0; i < iters; i++ ) {
+            auto it = vars.find(names[i & 7]);
+            it->second += i;
+            sum += it->second % 7;
+            s += names[i & 7];
+            if( s.size() > 64 )
+                s.clear();
+        }
+        std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+        // keep the loop from being optimised away
+        volatile long keep = sum + s.size();
+        (void)keep;
+        best = max(best, iters / took.count());
+    }
+    return best;
+}
+
+int RunBench(const string& baselineFile, double threshold, bool write)
+{
+    const int nstmts = 20000;
+
+    map<string, double> baseline;
+    std::ifstream bf(baselineFile);
+    if( !write && !bf.is_open() ) {
+        cerr << "NO BASELINE " << baselineFile << "; set BENCH_WRITE=1 to record one" << endl;
+        return -1;
+    }
+    string name;
+    double score;
+    while( bf >> name >> score )
+        baseline[name] = score;
+
+    int regressions = 0;
+    std::ofstream nf;
+    if( write ) {
+        nf.open(baselineFile);
+        if( !nf ) {
+            cerr << "COULD NOT WRITE " << baselineFile << endl;
+            return -1;
+        }
+    }
+
+    double reference = Reference();
+    cerr << "reference: " << (long)reference << " iterations/s" << endl;
+    for( int w = 0; w < NUMWORKLOADS; w++ ) {
+        string wname = WorkloadName(Workload(w));
+        double rate = Throughput(RandomProgram(1000 + w, Workload(w), nstmts, false), nstmts);
+        double now = rate / reference;
+
+        cerr << wname << ": " << (long)rate << " stmts/s, " << now << " per reference iteration";
+        if( write ) {
+            nf << wname << " " << now << endl;
+        }
+        else if( !baseline.count(wname) ) {
+            cerr << " NOT IN BASELINE";
+            regressions++;
+        }
+        else {
+            double ratio = now / baseline[wname];
+            cerr << " (" << (int)(ratio * 100) << "% of baseline)";
+            if( ratio < 1 - threshold ) {
+                cerr << " REGRESSION";
+                regressions++;
+            }
+        }
+        cerr << endl;
+    }
+
+    if( write )
+        cerr << "baseline written to " << baselineFile << endl;
+    return regressions;
+}
@@ -0,0 +1,39 @@
+/*
+ * fuzz.h
+ */
+
+#ifndef FUZZ_H_
+#define FUZZ_H_
+
+#include <string>
+using std::string;
+
+// the kinds of program the generator produces; each stresses a different part of
+// the interpreter and has its own performance baseline
+enum Workload { ARITH, STRINGS, BRANCHES, MIXED, NUMWORKLOADS };
+
+extern const char *WorkloadName(Workload w);
+
+// RandomProgram returns a syntactically valid program of nstmts statements. With errors
+// set, a small fraction of statements read undefined variables, mix types or divide
+// by a variable that may be zero, so runtime failures are exercised too.
+extern string RandomProgram(unsigned seed, Workload w, int nstmts, bool errors = true);
+
+// RunFuzz runs count random programs through every execution mode and reports any
+// program whose output differs from the plain tree walker. That includes batch mode,
+// the generated C++ (built with $CXX against the sources in $FUZZ_SRC, default ".")
+// and a server started in a child process, as well as the interactive loop, the
+// profiler's evaluator and a snapshot saved and loaded between two runs; a mode that
+// cannot be set up is reported and left out. The edit mode instead puts each program
+// in a Document and checks a run of random edits against full parses. Returns the
+// mismatches.
+extern int RunFuzz(int count, unsigned seed);
+
+// RunBench measures throughput for each workload as a multiple of a native reference
+// loop timed in the same run, so the baseline holds on any machine, and compares it to
+// the baseline file. Returns the number of workloads that are slower than the baseline
+// by more than the threshold (0.2 means 20%) or missing from it, and -1 if there is no
+// baseline. With write set the measurements replace the baseline instead.
+extern int RunBench(const string& baselineFile, double threshold, bool write);
+
+#endif /* FUZZ_H_ */
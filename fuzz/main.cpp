@@ -0,0 +1,31 @@
+// The test driver: differential fuzzing and the throughput check, kept out of the
+// interpreter. Build it from the source directory with
+//   g++ -std=c++17 -O2 -pthread -I. -o fuzzer fuzz/*.cpp $(ls *.cpp | grep -vx main.cpp)
+// and run it from there too, since the emit-cpp mode builds against the sources
+// (FUZZ_SRC names another directory).
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include "fuzz.h"
+using namespace std;
+
+int main(int argc, char* argv[])
+{
+    for( int i = 1; i < argc; i++ ) {
+        string arg(argv[i]);
+        if( arg.compare(0, 6, "-fuzz=") == 0 ) {
+            unsigned seed = getenv("FUZZ_SEED") ? atoi(getenv("FUZZ_SEED")) : 1;
+            return RunFuzz(atoi(arg.c_str() + 6), seed) ? 1 : 0;
+        }
+        else if( arg.compare(0, 7, "-bench=") == 0 ) {
+            double threshold = getenv("BENCH_THRESHOLD") ? atof(getenv("BENCH_THRESHOLD")) : 0.2;
+            return RunBench(arg.substr(7), threshold, getenv("BENCH_WRITE") != 0) ? 1 : 0;
+        }
+        else {
+            cerr << "UNRECOGNIZED FLAG " << arg << endl;
+            return -1;
+        }
+    }
+    cerr << "USAGE: " << argv[0] << " -fuzz=COUNT | -bench=BASELINE" << endl;
+    return -1;
+}
@@ -0,0 +1,30 @@
+#include <functional>
+#include "intern.h"
+
+StringPool stringPool;
+thread_local StringPool *currentPool = &stringPool;
+
+// elements of an unordered_set never move, so the returned pointer stays valid
+const string *StringPool::Intern(const string& s)
+{
+    Shard& sh = shards[ std::hash<string>()(s) % SHARDS ];
+    std::lock_guard<std::mutex> guard(sh.lock);
+    return &*sh.strings.insert(s).first;
+}
+
+unsigned long *StringPool::Version(const string *sym)
+{
+    Shard& sh = shards[ std::hash<string>()(*sym) % SHARDS ];
+    std::lock_guard<std::mutex> guard(sh.lock);
+    return &sh.versions[sym];
+}
+
+size_t StringPool::Size()
+{
+    size_t n = 0;
+    for( auto& sh : shards ) {
+        std::lock_guard<std::mutex> guard(sh.lock);
+        n += sh.strings.size();
+    }
+    return n;
+}
@@ -0,0 +1,60 @@
+/*
+ * intern.h
+ */
+
+#ifndef INTERN_H_
+#define INTERN_H_
+
+#include <string>
+#include <unordered_set>
+#include <unordered_map>
+#include <mutex>
+using std::string;
+
+// StringPool keeps a single copy of every identifier and string literal seen by the
+// lexer. Equal strings intern to the same pointer, so names compare by address.
+// The pool is sharded so that parser threads rarely contend on the same lock.
+class StringPool {
+    static const unsigned SHARDS = 16;
+
+    struct Shard {
+        std::mutex	lock;
+        std::unordered_set<string>	strings;
+        std::unordered_map<const string*, unsigned long>	versions;
+    } shards[SHARDS];
+
+    unsigned long	generation = 0;
+
+public:
+    const string *Intern(const string& s);
+    size_t Size();
+
+    // Version returns a stable counter for an interned name. Assignments bump it so that
+    // cached results which read the name can tell they are stale.
+    unsigned long *Version(const string *sym);
+
+    // Generation changes whenever variables change behind the evaluator's back, for
+    // example when a symbol table is cleared or loaded; it invalidates every cache
+    unsigned long Generation() const { return generation; }
+    void NewGeneration() { ++generation; }
+};
+
+extern StringPool stringPool;
+
+// the pool the calling thread interns into: stringPool unless a PoolScope has put
+// another in place, as the server does so that each request's names and versions go
+// away with the request
+extern thread_local StringPool *currentPool;
+
+inline const string *Intern(const string& s) { return currentPool->Intern(s); }
+
+// PoolScope makes pool the calling thread's pool until the scope ends
+class PoolScope {
+    StringPool	*saved;
+
+public:
+    explicit PoolScope(StringPool *pool) : saved(currentPool) { currentPool = pool; }
+    ~PoolScope() { currentPool = saved; }
+};
+
+#endif /* INTERN_H_ */
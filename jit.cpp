@@ -0,0 +1,169 @@
+#include <cstring>
+#include "parsetree.h"
+#include "jit.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define JIT_SUPPORTED 1
+#endif
+
+bool jitEnabled = false;
+unsigned jitThreshold = 16;
+
+JitCode::~JitCode()
+{
+#ifdef JIT_SUPPORTED
+    if( mem )
+        munmap(mem, size);
+#endif
+}
+
+// Emitter generates a simple stack machine: every subtree leaves its result in eax,
+// and the left operand of a binary operator is parked on the native stack
+class Emitter {
+    vector<unsigned char>	code;
+    vector<size_t>			bails;	// rel32 fields that jump to the bail-out path
+    vector<const string*>	&vars;
+
+    void Byte(unsigned char b) { code.push_back(b); }
+    void Bytes(std::initializer_list<unsigned char> bs) { code.insert(code.end(), bs); }
+    void Imm32(int v) {
+        unsigned char b[4];
+        memcpy(b, &v, 4);
+        code.insert(code.end(), b, b + 4);
+    }
+    void JumpToBail(unsigned char cc) {
+        Bytes({0x0F, cc});				// jcc rel32
+        bails.push_back(code.size());
+        Imm32(0);
+    }
+
+    int VarSlot(const string *sym) {
+        for( size_t i = 0; i < vars.size(); i++ )
+            if( vars[i] == sym )
+                return i;
+        vars.push_back(sym);
+        return vars.size() - 1;
+    }
+
+public:
+    Emitter(vector<const string*> &vars) : vars(vars) {}
+
+    bool Expr(ParseTree *t) {
+        if( t->IntDefined() ) {
+            Byte(0xB8);					// mov eax, imm32
+            Imm32(t->getINTEGER());
+            return true;
+        }
+        if( t->IdentDefined() ) {
+            Bytes({0x8B, 0x87});		// mov eax, [rdi + disp32]
+            Imm32(4 * VarSlot(t->getSYMBOL()));
+            return true;
+        }
+
+        NodeKind k = t->GetKind();
+        if( k != PLUSNODE && k != MINUSNODE && k != TIMESNODE && k != DIVIDENODE )
+            return false;
+
+        if( !Expr(t->left) )
+            return false;
+        Byte(0x50);						// push rax
+        if( !Expr(t->right) )
+            return false;
+        Bytes({0x89, 0xC1});			// mov ecx, eax
+        Byte(0x58);						// pop rax
+
+        if( k == PLUSNODE )
+            Bytes({0x01, 0xC8});		// add eax, ecx
+        else if( k == MINUSNODE )
+            Bytes({0x29, 0xC8});		// sub eax, ecx
+        else if( k == TIMESNODE )
+            Bytes({0x0F, 0xAF, 0xC1});	// imul eax, ecx
+        else {
+            Bytes({0x85, 0xC9});		// test ecx, ecx
+            JumpToBail(0x84);			// je bail
+            Bytes({0x83, 0xF9, 0xFF});	// cmp ecx, -1
+            JumpToBail(0x84);			// je bail
+            Byte(0x99);					// cdq
+            Bytes({0xF7, 0xF9});		// idiv ecx
+        }
+        return true;
+    }
+
+    vector<unsigned char>& Function(ParseTree *t, bool &ok) {
+        Bytes({0x55, 0x48, 0x89, 0xE5});	// push rbp; mov rbp, rsp
+        ok = Expr(t);
+        Bytes({0x48, 0x89, 0xEC, 0x5D, 0xC3});	// mov rsp, rbp; pop rbp; ret
+
+        size_t bail = code.size();
+        Bytes({0x48, 0x89, 0xEC, 0x5D});	// mov rsp, rbp; pop rbp
+        Bytes({0xC7, 0x06});				// mov dword [rsi], 1
+        Imm32(1);
+        Bytes({0x31, 0xC0, 0xC3});			// xor eax, eax; ret
+
+        for( size_t at : bails ) {
+            int rel = bail - (at + 4);
+            memcpy(&code[at], &rel, 4);
+        }
+        return code;
+    }
+};
+
+JitCode *JitCompile(ParseTree *expr)
+{
+#ifdef JIT_SUPPORTED
+    JitCode *jc = new JitCode;
+    Emitter em(jc->vars);
+    bool ok;
+    vector<unsigned char>& code = em.Function(expr, ok);
+
+    // a lone constant or variable gains nothing from native code
+    if( !ok || (expr->left == 0 && expr->right == 0) ) {
+        delete jc;
+        return 0;
+    }
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    jc->size = (code.size() + page - 1) / page * page;
+    void *mem = mmap(0, jc->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if( mem == MAP_FAILED ) {
+        delete jc;
+        return 0;
+    }
+    memcpy(mem, code.data(), code.size());
+    if( mprotect(mem, jc->size, PROT_READ | PROT_EXEC) != 0 ) {
+        munmap(mem, jc->size);
+        delete jc;
+        return 0;
+    }
+    jc->mem = mem;
+    jc->fn = (JitCode::Fn)mem;
+    return jc;
+#else
+    return 0;
+#endif
+}
+
+bool JitRun(const JitCode *code, map<string, Value> &symbolMap, int &out)
+{
+    const size_t MAXVARS = 64;
+    int vals[MAXVARS];
+    vector<int> spill;
+    int *vars = vals;
+    if( code->vars.size() > MAXVARS ) {
+        spill.resize(code->vars.size());
+        vars = spill.data();
+    }
+
+    for( size_t i = 0; i < code->vars.size(); i++ ) {
+        auto it = symbolMap.find(*code->vars[i]);
+        if( it == symbolMap.end() || !it->second.isIntType() )
+            return false;
+        vars[i] = it->second.getInteger();
+    }
+
+    int status = 0;
+    out = code->fn(vars, &status);
+    return status == 0;
+}
@@ -0,0 +1,66 @@
+/*
+ * jit.h
+ */
+
+#ifndef JIT_H_
+#define JIT_H_
+
+#include <string>
+#include <vector>
+#include <map>
+using std::string;
+using std::vector;
+using std::map;
+
+class ParseTree;
+class Value;
+
+// JitCode is an int-only expression compiled to x86-64. The native function reads
+// its variables from an array of ints and sets *status to nonzero when it has to bail
+// out (division by zero or -1), in which case the tree walker evaluates instead.
+struct JitCode {
+    typedef int (*Fn)(const int *vars, int *status);
+
+    Fn		fn;
+    void	*mem;
+    size_t	size;
+    vector<const string*>	vars;
+
+    JitCode() : fn(0), mem(0), size(0) {}
+    ~JitCode();
+};
+
+extern bool jitEnabled;
+extern unsigned jitThreshold;
+
+// JitCompile returns native code for expr if it only uses int constants, variables
+// and + - * /, or 0 if the tree cannot be compiled or this is not an x86-64 Linux host
+extern JitCode *JitCompile(ParseTree *expr);
+
+// JitRun returns false when a variable is missing or not an int
+extern bool JitRun(const JitCode *code, map<string, Value> &symbolMap, int &out);
+
+// JitSite counts executions of one expression and compiles it once it gets hot
+class JitSite {
+    unsigned	hits;
+    bool		tried;
+    JitCode		*code;
+
+public:
+    JitSite() : hits(0), tried(false), code(0) {}
+    ~JitSite() { delete code; }
+
+    bool Run(ParseTree *expr, map<string, Value> &symbolMap, int &out) {
+        if( code == 0 ) {
+            if( tried || ++hits < jitThreshold )
+                return false;
+            tried = true;
+            code = JitCompile(expr);
+            if( code == 0 )
+                return false;
+        }
+        return JitRun(code, symbolMap, out);
+    }
+};
+
+#endif /* JIT_H_ */
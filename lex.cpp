@@ -1,8 +1,10 @@
 #include <cctype>
+#include <charconv>
 #include <map>
 using std::map;
 
 #include "tokens.h"
+#include "intern.h"
 
 static map<TokenType,string> tokenPrint = {
         { IF, "IF" },
@@ -58,13 +60,11 @@ static map<string,TokenType> kwmap = {
 Token
 id_or_kw(const string& lexeme, int linenum)
 {
-    TokenType tt = IDENT;
-
     auto kIt = kwmap.find(lexeme);
     if( kIt != kwmap.end() )
-        tt = kIt->second;
+        return Token(kIt->second, lexeme, linenum);
 
-    return Token(tt, lexeme, linenum);
+    return Token(IDENT, Intern(lexeme), linenum);
 }
 
 
@@ -164,7 +164,7 @@ getNextToken(istream *in, int *linenum)
                 }
                 if( ch == '"' ) {
                     lexeme = lexeme.substr(1, lexeme.length()-2);
-                    return Token(SCONST, lexeme, *linenum );
+                    return Token(SCONST, Intern(lexeme), *linenum );
                 }
                 break;
 
@@ -243,6 +243,12 @@ getNextToken(istream *in, int *linenum)
                     if( ch == '\n' )
                         (*linenum)--;
                     in->putback(ch);
+
+                    // a constant that does not fit in an int is an error token
+                    int val;
+                    auto res = std::from_chars(lexeme.data(), lexeme.data() + lexeme.size(), val);
+                    if( res.ec == std::errc::result_out_of_range )
+                        return Token(ERR, lexeme, *linenum);
                     return Token(ICONST, lexeme, *linenum);
                 }
                 break;
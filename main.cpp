@@ -8,40 +8,264 @@
 #include <iterator>
 #include "tokens.h"
 #include "parse.h"
+#include "flatast.h"
+#include "passes.h"
+#include "snapshot.h"
+#include "batch.h"
+#include "server.h"
+#include "transpile.h"
+#include "profile.h"
+#include "repl.h"
 #include <map>
 #include <vector>
+#include <thread>
+#include <unistd.h>
 using namespace std;
-map<string, Value> symbolMap;
-
 void RunTimeError (string msg){
     cout << "0: RUNTIME ERROR " << msg << endl;
     exit(1);
 }
+
 int main(int argc, char* argv[])
 {
     ifstream infile1;
     istream *in = &cin;
     int linenum = 0;
-    if (argc == 2) {
-        string arg(argv[1]);
-        infile1.open(arg);
+    bool parallel = false;
+    bool pipelined = false;
+    bool errorLines = false;
+    bool interactive = false;
+    bool flat = false;
+    bool timePasses = false;
+    bool showStats = false;
+    bool dce = false;
+    PassManager passes;
+    string filename;
+    string loadFile, saveFile;
+    string batchFile;
+    string servePath, clientPath;
+    string cppFile;
+    string profileFile;
+    int threads = thread::hardware_concurrency();
+
+    for( int i = 1; i < argc; i++ ) {
+        string arg(argv[i]);
+        if( arg == "-p" ) {
+            parallel = true;
+        }
+        else if( arg == "-pipe" ) {
+            pipelined = true;
+        }
+        else if( arg == "-dce" ) {
+            dce = true;
+        }
+        else if( arg == "-memo" ) {
+            passes.Add(new MemoizePass);
+        }
+        else if( arg == "-cse" ) {
+            passes.Add(new CsePass);
+        }
+        else if( arg == "-time-passes" ) {
+            timePasses = true;
+        }
+        else if( arg == "-stats" ) {
+            showStats = true;
+        }
+        else if( arg == "-flat" ) {
+            flat = true;
+        }
+        else if( arg == "-i" ) {
+            interactive = true;
+        }
+        else if( arg == "-lines" ) {
+            errorLines = true;
+        }
+        else if( arg == "-jit" ) {
+            jitEnabled = true;
+        }
+        else if( arg.compare(0, 5, "-jit=") == 0 ) {
+            jitEnabled = true;
+            jitThreshold = atoi(arg.c_str() + 5);
+        }
+        else if( arg.compare(0, 7, "-serve=") == 0 ) {
+            servePath = arg.substr(7);
+        }
+        else if( arg.compare(0, 8, "-client=") == 0 ) {
+            clientPath = arg.substr(8);
+        }
+        else if( arg.compare(0, 9, "-threads=") == 0 ) {
+            threads = atoi(arg.c_str() + 9);
+        }
+        else if( arg.compare(0, 10, "-emit-cpp=") == 0 ) {
+            cppFile = arg.substr(10);
+        }
+        else if( arg.compare(0, 9, "-profile=") == 0 ) {
+            profileFile = arg.substr(9);
+        }
+        else if( arg.compare(0, 7, "-batch=") == 0 ) {
+            batchFile = arg.substr(7);
+        }
+        else if( arg.compare(0, 6, "-load=") == 0 ) {
+            loadFile = arg.substr(6);
+        }
+        else if( arg.compare(0, 6, "-save=") == 0 ) {
+            saveFile = arg.substr(6);
+        }
+        else if( arg.compare(0, 11, "-max-steps=") == 0 ) {
+            evalBudget.maxSteps = strtoul(arg.c_str() + 11, 0, 10);
+        }
+        else if( arg.compare(0, 10, "-max-time=") == 0 ) {
+            evalBudget.maxSeconds = atof(arg.c_str() + 10);
+        }
+        else if( arg.compare(0, 12, "-max-output=") == 0 ) {
+            evalBudget.maxOutput = strtoul(arg.c_str() + 12, 0, 10);
+        }
+        else if( arg.compare(0, 12, "-max-string=") == 0 ) {
+            evalBudget.maxString = strtoul(arg.c_str() + 12, 0, 10);
+        }
+        else if( arg[0] == '-' && arg.size() > 1 ) {
+            cerr << "UNRECOGNIZED FLAG " << arg << endl;
+            return -1;
+        }
+        else if( filename.size() ) {
+            cerr << "TOO MANY FILENAMES" << endl;
+            return -1;
+        }
+        else {
+            filename = arg;
+        }
+    }
+
+    // the server applies the -max-* limits to every request it runs
+    if( servePath.size() )
+        return RunServer(servePath, threads, evalBudget);
+
+    if( filename.size() ) {
+        infile1.open(filename);
         if (infile1.is_open() == false)
         {
-            cout << "COULD NOT OPEN " << arg << endl;
+            cout << "COULD NOT OPEN " << filename << endl;
             return -1;
         }
         in = &infile1;
     }
-    if (argc > 2) {
-        cerr << "TOO MANY FILENAMES" << endl;
+
+    if( clientPath.size() ) {
+        int status = RunClient(clientPath, in);
+        if( status < 0 ) {
+            cout << "COULD NOT REACH SERVER " << clientPath << endl;
+            return -1;
+        }
+        return status;
+    }
+
+    // a snapshot stands in for the prelude that produced it
+    if( loadFile.size() && !LoadSnapshot(loadFile, symbolMap) ) {
+        cout << "COULD NOT LOAD SNAPSHOT " << loadFile << endl;
         return -1;
     }
 
-    ParseTree *prog = Prog(in, &linenum);
+    // a terminal on stdin gets the interactive loop
+    if( interactive || (filename.empty() && isatty(0)) ) {
+        evalBudget.Start();
+        Repl(in, &linenum, symbolMap, isatty(0));
+        if( saveFile.size() && !SaveSnapshot(saveFile, symbolMap) ) {
+            cout << "COULD NOT SAVE SNAPSHOT " << saveFile << endl;
+            return -1;
+        }
+        return 0;
+    }
+
+    ParseTree *prog;
+    if( parallel )
+        prog = ParallelProg(in, &linenum, threads);
+    else if( pipelined )
+        prog = PipelinedProg(in, &linenum);
+    else
+        prog = Prog(in, &linenum);
     if (prog == 0)
     {
         return 0; // quit on error
     }
-    prog->Eval(symbolMap);
+
+    // dead stores are only dead if the symbol table is not saved afterwards
+    if( dce )
+        passes.Add(new DeadCodePass(saveFile.size() > 0));
+    // counted before the passes too, so what is printed relies on them keeping the cache current
+    if( showStats )
+        prog->Stats();
+    passes.Run(prog);
+    if( timePasses )
+        passes.Report(cerr);
+    if( showStats && prog ) {
+        const TreeStats& ts = prog->Stats();
+        cerr << ts.leaves << " leaves, " << ts.strings << " strings, " << ts.idents
+             << " identifiers (" << ts.unique.size() << " distinct)" << endl;
+    }
+
+    // the program is written out as C++ to be compiled instead of being run
+    if( cppFile.size() ) {
+        ofstream cpp(cppFile);
+        if( cpp )
+            EmitCpp(prog, filename.size() ? filename : "standard input", cpp);
+        delete prog;
+        if( !cpp ) {
+            cout << "COULD NOT WRITE " << cppFile << endl;
+            return -1;
+        }
+        return 0;
+    }
+
+    // the program runs once per record, reading variables from the columns of the file
+    if( batchFile.size() ) {
+        evalBudget.Start();
+        long failed = RunBatch(prog, batchFile, symbolMap, cout);
+        delete prog;
+        if( failed < 0 ) {
+            cout << "COULD NOT OPEN " << batchFile << endl;
+            return -1;
+        }
+        return 0;
+    }
+
+    // evaluation never exits on its own; a failure comes back as an error Value,
+    // including running out of the budget set by -max-steps, -max-time and -max-output
+    evalBudget.Start();
+    Value result;
+    if( flat ) {
+        FlatTree *ft = Flatten(prog);
+        delete prog;
+        result = FlatEval(*ft, symbolMap);
+        delete ft;
+    }
+    else if( profileFile.size() ) {
+        // samples name the nodes they landed in, so the profile is written before the
+        // program can be deleted
+        ofstream folded(profileFile);
+        if( !folded || !profiler.Start() ) {
+            cout << "COULD NOT PROFILE TO " << profileFile << endl;
+            return -1;
+        }
+        result = profiler.Eval(prog, symbolMap);
+        profiler.Stop();
+        profiler.WriteFolded(folded);
+        if( profiler.Dropped() )
+            cerr << profiler.Dropped() << " of " << profiler.Samples()
+                 << " samples dropped, too many distinct stacks" << endl;
+    }
+    else {
+        result = prog->Eval(symbolMap);
+    }
+    if( result.isFailure() ) {
+        if( errorLines ) {
+            cout << result.getErrorLine() << ": RUNTIME ERROR " << result.getErrorText() << endl;
+            return 1;
+        }
+        RunTimeError(result.getErrorText());
+    }
+    if( saveFile.size() && !SaveSnapshot(saveFile, symbolMap) ) {
+        cout << "COULD NOT SAVE SNAPSHOT " << saveFile << endl;
+        return -1;
+    }
     return 0;
-}
\ No newline at end of file
+}
@@ -1,37 +1,82 @@
+#include <algorithm>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <iterator>
 #include "parse.h"
+#include "tokstream.h"
 
+// the interpreter's globals live here rather than next to main, so that the fuzzer,
+// which has a main of its own, links against the same objects
+map<string, Value> symbolMap;
+thread_local ostream *printOut = &cout;
+
+// parser state is kept per thread so that ParallelProg can parse chunks concurrently
 namespace Parser {
-    bool pushed_back = false;
-    Token	pushed_token;
+    thread_local TokenStream tokens;
 
-    static Token GetNextToken(istream *in, int *line) {
-        if( pushed_back ) {
-            pushed_back = false;
-            return pushed_token;
-        }
-        return getNextToken(in, line);
+    static void Begin(istream *in, int line) {
+        tokens.Reset(in, line);
+    }
+
+    static const Token& GetNextToken(istream *in, int *line) {
+        if( tokens.Source() != in )
+            Begin(in, *line);
+        return tokens.Get(line);
+    }
+
+    static void PushBackToken() {
+        tokens.PushBack();
     }
 
-    static void PushBackToken(Token& t) {
-        if( pushed_back ) {
-            abort();
+    // every level of parentheses, assignment or nested if is a level of recursion here
+    // and in the evaluator, so input nested past MAXNESTING is refused rather than
+    // allowed to overflow the stack
+    static const int MAXNESTING = 1000;
+    thread_local int nesting = 0;
+
+    class Nest {
+    public:
+        Nest() { ++nesting; }
+        ~Nest() { --nesting; }
+        bool TooDeep() const { return nesting > MAXNESTING; }
+    };
+
+    // SkipStatement discards the rest of a statement after a syntax error
+    static void SkipStatement(istream *in, int *line) {
+        if( tokens.Last() == SC || tokens.Last() == DONE )
+            return;
+        while( true ) {
+            const Token& t = GetNextToken(in, line);
+            if( t == SC || t == DONE )
+                return;
         }
-        pushed_back = true;
-        pushed_token = t;
     }
 
 }
 
-static int error_count = 0;
+// IntOutOfRange is true for the error token the lexer makes from an oversized constant
+static bool IntOutOfRange(const Token& t)
+{
+    const string& lex = t.GetLexeme();
+    if( t != ERR || lex.empty() )
+        return false;
+    size_t start = lex[0] == '-' ? 1 : 0;
+    return lex.size() > start && lex.find_first_not_of("0123456789", start) == string::npos;
+}
+
+static thread_local int error_count = 0;
+static thread_local ostream *error_out = 0;	// 0 means printOut
 
 void
 ParseError(int line, string msg)
 {
     ++error_count;
-    cout << line << ": " << msg << endl;
+    *(error_out ? error_out : printOut) << line << ": " << msg << endl;
 }
 
-ParseTree *Prog(istream *in, int *line)
+// Program parses a whole program from tokens already set up for in
+static ParseTree *Program(istream *in, int *line)
 {
     ParseTree *sl = Slist(in, line);
 
@@ -44,24 +89,223 @@ ParseTree *Prog(istream *in, int *line)
     return sl;
 }
 
+ParseTree *Prog(istream *in, int *line)
+{
+    error_count = 0;
+    Parser::Begin(in, *line);
+    return Program(in, line);
+}
+
+// PipelinedProg is Prog with the lexer running on a second thread
+ParseTree *PipelinedProg(istream *in, int *line)
+{
+    error_count = 0;
+    TokenPipe pipe(in, *line);
+    Parser::tokens.Reset(in, *line, &pipe);
+    ParseTree *prog = Program(in, line);
+    Parser::tokens.Reset(0, *line);
+    return prog;
+}
+
 // Slist is a Statement followed by a Statement List
+// the list is built in a loop so very long programs do not exhaust the stack
 ParseTree *Slist(istream *in, int *line) {
+    ParseTree *head = 0;
+    ParseTree *tail = 0;
+
+    while( true ) {
+        ParseTree *s = Stmt(in, line);
+        if( s == 0 )
+            break;
+
+        if( Parser::GetNextToken(in, line) != SC ) {
+            ParseError(*line, "Missing semicolon");
+            delete s;
+            break;
+        }
+
+        ParseTree *sl = new StmtList(s, 0);
+        if( tail )
+            tail->right = sl;
+        else
+            head = sl;
+        tail = sl;
+    }
+
+    return head;
+}
+
+// ParseStatement parses one statement and its semicolon for interactive use. The token
+// stream carries over between calls, and after a syntax error the rest of the statement
+// is skipped so the next call starts clean. *done is set once the input is exhausted.
+ParseTree *ParseStatement(istream *in, int *line, bool *done)
+{
+    error_count = 0;
+    *done = false;
+
     ParseTree *s = Stmt(in, line);
-    if( s == 0 )
+    if( s == 0 ) {
+        if( error_count == 0 )
+            *done = true;
+        else
+            Parser::SkipStatement(in, line);
         return 0;
+    }
 
     if( Parser::GetNextToken(in, line) != SC ) {
         ParseError(*line, "Missing semicolon");
+        delete s;
+        Parser::SkipStatement(in, line);
         return 0;
     }
 
-    return new StmtList(s, Slist(in,line));
+    return s;
+}
+
+// NextCut returns the offset just past the first semicolon at or after from that ends a
+// statement, or the end of the text. Text split there lexes exactly as it would in the
+// whole stream. The scan mirrors the lexer: strings end at a quote or newline, # comments
+// run to the end of the line, and the character after & or | is always consumed by the
+// lexer. from must itself be the start of the text or a previous cut.
+size_t NextCut(const string& text, size_t from)
+{
+    for( size_t i = from; i < text.size(); i++ ) {
+        char ch = text[i];
+
+        if( ch == '"' ) {
+            while( ++i < text.size() && text[i] != '"' && text[i] != '\n' )
+                ;
+        }
+        else if( ch == '#' ) {
+            while( ++i < text.size() && text[i] != '\n' )
+                ;
+        }
+        else if( ch == '&' || ch == '|' ) {
+            i++;
+        }
+        else if( ch == ';' && i + 1 < text.size() ) {
+            return i + 1;
+        }
+    }
+
+    return text.size();
+}
+
+// StatementCuts returns cuts at least chunkSize bytes apart
+static vector<size_t> StatementCuts(const string& text, size_t chunkSize)
+{
+    vector<size_t> cuts;
+    size_t next = chunkSize;
+
+    for( size_t at = NextCut(text, 0); at < text.size(); at = NextCut(text, at) ) {
+        if( at >= next ) {
+            cuts.push_back(at);
+            next = at + chunkSize;
+        }
+    }
+
+    return cuts;
+}
+
+void ParseChunk(const string& text, int startLine, ChunkResult *res)
+{
+    istringstream in(text);
+    ostringstream msgs;
+    int line = startLine;
+
+    Parser::Begin(&in, line);
+    error_count = 0;
+    error_out = &msgs;
+
+    res->tree = Slist(&in, &line);
+    res->errors = error_count;
+    res->endLine = line;
+    res->messages = msgs.str();
+
+    error_out = 0;
+    error_count = 0;
+}
+
+// ParallelProg reads the whole stream, splits it at statement boundaries, parses the
+// pieces on separate threads and links the resulting statement lists in order. Pieces
+// are at least minChunk bytes so small inputs are not split needlessly.
+// Errors and line numbers are reported exactly as Prog would report them.
+ParseTree *ParallelProg(istream *in, int *line, int nthreads, size_t minChunk)
+{
+    string text( (istreambuf_iterator<char>(*in)), istreambuf_iterator<char>() );
+    error_count = 0;
+
+    if( nthreads < 1 )
+        nthreads = 1;
+    size_t chunkSize = max(minChunk, text.size() / nthreads + 1);
+
+    vector<size_t> cuts = StatementCuts(text, chunkSize);
+    cuts.push_back(text.size());
+
+    size_t nchunks = cuts.size();
+    vector<ChunkResult> results(nchunks);
+    vector<thread> workers;
+
+    // the workers intern into the caller's pool, which the server sets per request
+    StringPool *pool = currentPool;
+    size_t begin = 0;
+    int startLine = *line;
+    for( size_t i = 0; i < nchunks; i++ ) {
+        string piece = text.substr(begin, cuts[i] - begin);
+        ChunkResult *res = &results[i];
+        workers.push_back( thread([pool, piece, startLine, res] {
+            PoolScope scope(pool);
+            ParseChunk(piece, startLine, res);
+        }) );
+        startLine += count(piece.begin(), piece.end(), '\n');
+        begin = cuts[i];
+    }
+    for( auto& w : workers )
+        w.join();
+
+    // a sequential parse stops at the first chunk with an error, so later chunks are dropped
+    ParseTree *head = 0;
+    ParseTree *tail = 0;
+    bool failed = false;
+    for( size_t i = 0; i < nchunks; i++ ) {
+        ChunkResult& r = results[i];
+        if( failed ) {
+            delete r.tree;
+            continue;
+        }
+
+        *line = r.endLine;
+        if( r.tree ) {
+            if( tail )
+                tail->right = r.tree;
+            else
+                head = r.tree;
+            for( tail = r.tree; tail->right; tail = tail->right )
+                ;
+        }
+
+        if( r.errors ) {
+            *printOut << r.messages;
+            error_count += r.errors;
+            failed = true;
+        }
+    }
+
+    if( head == 0 )
+        ParseError(*line, "No statements in program");
+
+    if( error_count ) {
+        delete head;
+        return 0;
+    }
+
+    return head;
 }
 
 ParseTree *Stmt(istream *in, int *line) {
     ParseTree *s;
 
-    Token t = Parser::GetNextToken(in, line);
+    const Token& t = Parser::GetNextToken(in, line);
     switch( t.GetTokenType() ) {
         case IF:
             s = IfStmt(in, line);
@@ -75,12 +319,15 @@ ParseTree *Stmt(istream *in, int *line) {
             return 0;
 
         case ERR:
-            ParseError(*line, "Invalid token");
+            if( IntOutOfRange(t) )
+                ParseError(*line, "Integer constant " + t.GetLexeme() + " out of range");
+            else
+                ParseError(*line, "Invalid token");
             return 0;
 
         default:
             // put back the token and then see if it's an Expr
-            Parser::PushBackToken(t);
+            Parser::PushBackToken();
             s = Expr(in, line);
             if( s == 0 ) {
                 ParseError(*line, "Invalid statement");
@@ -94,18 +341,25 @@ ParseTree *Stmt(istream *in, int *line) {
 }
 
 ParseTree *IfStmt(istream *in, int *line) {
+    Parser::Nest nest;
+    if( nest.TooDeep() ) {
+        ParseError(*line, "Statement nested too deeply");
+        return 0;
+    }
+
     ParseTree *ex = Expr(in, line);
     if( ex == 0 ) {
         ParseError(*line, "Missing expression after if");
         return 0;
     }
 
-    Token t = Parser::GetNextToken(in, line);
+    const Token& t = Parser::GetNextToken(in, line);
 
     if( t != THEN ) {
         ParseError(*line, "Missing THEN after expression");
         return 0;
     }
+    int l = t.GetLinenum();
 
     ParseTree *stmt = Stmt(in, line);
     if( stmt == 0 ) {
@@ -113,7 +367,7 @@ ParseTree *IfStmt(istream *in, int *line) {
         return 0;
     }
 
-    return new IfStatement(t.GetLinenum(), ex, stmt);
+    return new IfStatement(l, ex, stmt);
 }
 
 ParseTree *PrintStmt(istream *in, int *line) {
@@ -129,17 +383,24 @@ ParseTree *PrintStmt(istream *in, int *line) {
 }
 
 ParseTree *Expr(istream *in, int *line) {
+    Parser::Nest nest;
+    if( nest.TooDeep() ) {
+        ParseError(*line, "Expression nested too deeply");
+        return 0;
+    }
+
     ParseTree *t1 = LogicExpr(in, line);
     if( t1 == 0 ) {
         return 0;
     }
 
-    Token t = Parser::GetNextToken(in, line);
+    const Token& t = Parser::GetNextToken(in, line);
 
     if( t != ASSIGN ) {
-        Parser::PushBackToken(t);
+        Parser::PushBackToken();
         return t1;
     }
+    int l = t.GetLinenum();
 
     ParseTree *t2 = Expr(in, line); // right assoc
     if( t2 == 0 ) {
@@ -147,7 +408,7 @@ ParseTree *Expr(istream *in, int *line) {
         return 0;
     }
 
-    return new Assignment(t.GetLinenum(), t1, t2);
+    return new Assignment(l, t1, t2);
 }
 
 ParseTree *LogicExpr(istream *in, int *line) {
@@ -157,12 +418,14 @@ ParseTree *LogicExpr(istream *in, int *line) {
     }
 
     while ( true ) {
-        Token t = Parser::GetNextToken(in, line);
+        const Token& t = Parser::GetNextToken(in, line);
 
         if( t != LOGICAND && t != LOGICOR ) {
-            Parser::PushBackToken(t);
+            Parser::PushBackToken();
             return t1;
         }
+        TokenType tt = t.GetTokenType();
+        int l = t.GetLinenum();
 
         ParseTree *t2 = CompareExpr(in, line);
         if( t2 == 0 ) {
@@ -170,10 +433,10 @@ ParseTree *LogicExpr(istream *in, int *line) {
             return 0;
         }
 
-        if( t == LOGICAND )
-            t1 = new LogicAndExpr(t.GetLinenum(), t1, t2);
+        if( tt == LOGICAND )
+            t1 = new LogicAndExpr(l, t1, t2);
         else
-            t1 = new LogicOrExpr(t.GetLinenum(), t1, t2);
+            t1 = new LogicOrExpr(l, t1, t2);
     }
 }
 
@@ -184,12 +447,14 @@ ParseTree *CompareExpr(istream *in, int *line) {
     }
 
     while ( true ) {
-        Token t = Parser::GetNextToken(in, line);
+        const Token& t = Parser::GetNextToken(in, line);
 
         if( t != EQ && t != NEQ && t != GT && t != GEQ && t != LT && t != LEQ) {
-            Parser::PushBackToken(t);
+            Parser::PushBackToken();
             return t1;
         }
+        TokenType tt = t.GetTokenType();
+        int l = t.GetLinenum();
 
         ParseTree *t2 = AddExpr(in, line);
         if( t2 == 0 ) {
@@ -197,24 +462,24 @@ ParseTree *CompareExpr(istream *in, int *line) {
             return 0;
         }
 
-        switch( t.GetTokenType() ) {
+        switch( tt ) {
             case EQ:
-                t1 = new EqExpr(t.GetLinenum(), t1, t2);
+                t1 = new EqExpr(l, t1, t2);
                 break;
             case NEQ:
-                t1 = new NEqExpr(t.GetLinenum(), t1, t2);
+                t1 = new NEqExpr(l, t1, t2);
                 break;
             case GT:
-                t1 = new GtExpr(t.GetLinenum(), t1, t2);
+                t1 = new GtExpr(l, t1, t2);
                 break;
             case GEQ:
-                t1 = new GEqExpr(t.GetLinenum(), t1, t2);
+                t1 = new GEqExpr(l, t1, t2);
                 break;
             case LT:
-                t1 = new LtExpr(t.GetLinenum(), t1, t2);
+                t1 = new LtExpr(l, t1, t2);
                 break;
             case LEQ:
-                t1 = new LEqExpr(t.GetLinenum(), t1, t2);
+                t1 = new LEqExpr(l, t1, t2);
                 break;
             default:
                 break;
@@ -229,12 +494,14 @@ ParseTree *AddExpr(istream *in, int *line) {
     }
 
     while ( true ) {
-        Token t = Parser::GetNextToken(in, line);
+        const Token& t = Parser::GetNextToken(in, line);
 
         if( t != PLUS && t != MINUS ) {
-            Parser::PushBackToken(t);
+            Parser::PushBackToken();
             return t1;
         }
+        TokenType tt = t.GetTokenType();
+        int l = t.GetLinenum();
 
         ParseTree *t2 = MulExpr(in, line);
         if( t2 == 0 ) {
@@ -242,10 +509,10 @@ ParseTree *AddExpr(istream *in, int *line) {
             return 0;
         }
 
-        if( t == PLUS )
-            t1 = new PlusExpr(t.GetLinenum(), t1, t2);
+        if( tt == PLUS )
+            t1 = new PlusExpr(l, t1, t2);
         else
-            t1 = new MinusExpr(t.GetLinenum(), t1, t2);
+            t1 = new MinusExpr(l, t1, t2);
     }
 }
 
@@ -256,12 +523,14 @@ ParseTree *MulExpr(istream *in, int *line) {
     }
 
     while ( true ) {
-        Token t = Parser::GetNextToken(in, line);
+        const Token& t = Parser::GetNextToken(in, line);
 
         if( t != STAR && t != SLASH ) {
-            Parser::PushBackToken(t);
+            Parser::PushBackToken();
             return t1;
         }
+        TokenType tt = t.GetTokenType();
+        int l = t.GetLinenum();
 
         ParseTree *t2 = Factor(in, line);
         if( t2 == 0 ) {
@@ -269,22 +538,23 @@ ParseTree *MulExpr(istream *in, int *line) {
             return 0;
         }
 
-        if( t == STAR )
-            t1 = new TimesExpr(t.GetLinenum(), t1, t2);
+        if( tt == STAR )
+            t1 = new TimesExpr(l, t1, t2);
         else
-            t1 = new DivideExpr(t.GetLinenum(), t1, t2);
+            t1 = new DivideExpr(l, t1, t2);
     }
 }
 
 ParseTree *Factor(istream *in, int *line) {
     bool neg = false;
-    Token t = Parser::GetNextToken(in, line);
+    const Token& t = Parser::GetNextToken(in, line);
+    int l = t.GetLinenum();
 
     if( t == MINUS ) {
         neg = true;
     }
     else {
-        Parser::PushBackToken(t);
+        Parser::PushBackToken();
     }
 
     ParseTree *p1 = Primary(in, line);
@@ -294,14 +564,14 @@ ParseTree *Factor(istream *in, int *line) {
     }
 
     if( neg ) {
-        return new TimesExpr(t.GetLinenum(), new IConst(t.GetLinenum(), -1), p1);
+        return new TimesExpr(l, new IConst(l, -1), p1);
     }
     else
         return p1;
 }
 
 ParseTree *Primary(istream *in, int *line) {
-    Token t = Parser::GetNextToken(in, line);
+    const Token& t = Parser::GetNextToken(in, line);
 
     if( t == IDENT ) {
         return new Ident(t);
@@ -331,6 +601,9 @@ ParseTree *Primary(istream *in, int *line) {
         return 0;
     }
 
-    ParseError(*line, "Primary expected");
+    if( IntOutOfRange(t) )
+        ParseError(*line, "Integer constant " + t.GetLexeme() + " out of range");
+    else
+        ParseError(*line, "Primary expected");
     return 0;
 }
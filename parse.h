@@ -7,7 +7,22 @@ using namespace std;
 #include "tokens.h"
 #include "parsetree.h"
 
+// ChunkResult is what parsing one piece of a program produced; messages holds the
+// diagnostics the piece would have printed
+struct ChunkResult {
+    ParseTree	*tree = 0;
+    int			errors = 0;
+    int			endLine = 0;
+    string		messages;
+};
+
+extern size_t NextCut(const string& text, size_t from);
+extern void ParseChunk(const string& text, int startLine, ChunkResult *res);
+
 extern ParseTree *Prog(istream *in, int *line);
+extern ParseTree *PipelinedProg(istream *in, int *line);
+extern ParseTree *ParallelProg(istream *in, int *line, int nthreads, size_t minChunk = 64 * 1024);
+extern ParseTree *ParseStatement(istream *in, int *line, bool *done);
 extern ParseTree *Slist(istream *in, int *line);
 extern ParseTree *Stmt(istream *in, int *line);
 extern ParseTree *IfStmt(istream *in, int *line);
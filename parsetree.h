@@ -7,42 +7,128 @@
 
 #include <vector>
 #include <map>
+#include <set>
+#include <functional>
+#include <charconv>
+#include "tokens.h"
 #include "value.h"
+#include "intern.h"
+#include "jit.h"
 using std::vector;
 using std::map;
-static vector<string> idents;
+using std::set;
+
+// TreeStats is computed in a single side-effect-free pass over a tree and cached on its
+// root. Leaves include the root itself; string and identifier counts cover the nodes
+// below the root, and identList lists those identifiers in preorder.
+struct TreeStats {
+    int		leaves = 0;
+    int		strings = 0;
+    int		idents = 0;
+    vector<string>	identList;
+    set<string>		unique;
+
+    bool operator==(const TreeStats& o) const {
+        return leaves == o.leaves && strings == o.strings && idents == o.idents
+               && identList == o.identList && unique == o.unique;
+    }
+};
 
 // NodeType represents all possible types
 enum NodeType { ERRTYPE, INTTYPE, STRTYPE, BOOLTYPE, IDENTTYPE };
 
+// NodeKind says which ParseTree class a node is, so visitors can dispatch with a switch
+enum NodeKind {
+    LISTNODE, IFNODE, ASSIGNNODE, PRINTNODE,
+    PLUSNODE, MINUSNODE, TIMESNODE, DIVIDENODE,
+    ANDNODE, ORNODE,
+    EQNODE, NEQNODE, LTNODE, LEQNODE, GTNODE, GEQNODE,
+    ICONSTNODE, BCONSTNODE, SCONSTNODE, IDENTNODE,
+    MEMONODE,
+    NUMNODEKINDS
+};
+
+inline const char *NodeKindName(NodeKind k) {
+    static const char *names[NUMNODEKINDS] = {
+        "StmtList", "If", "Assign", "Print",
+        "Plus", "Minus", "Times", "Divide",
+        "And", "Or",
+        "Eq", "NEq", "Lt", "LEq", "Gt", "GEq",
+        "IConst", "BoolConst", "SConst", "Ident",
+        "Memo",
+    };
+    return names[k];
+}
+
 // a "forward declaration" for a class to hold values
 class Value;
 extern map<string, Value> symbolMap;
 
+// where print statements and parse errors go; cout unless a server thread is running
+// a request into a buffer
+extern thread_local ostream *printOut;
+
 class ParseTree {
+    NodeKind	kind;
     int			linenum;
+    unsigned	refs;
+    mutable TreeStats	*stats;
 public:
 
     ParseTree	*left;
     ParseTree	*right;
-    ParseTree(int linenum, ParseTree *l = 0, ParseTree *r = 0)
-            : linenum(linenum), left(l), right(r) {}
+    ParseTree(NodeKind kind, int linenum, ParseTree *l = 0, ParseTree *r = 0)
+            : kind(kind), linenum(linenum), refs(1), stats(0), left(l), right(r) {}
 
     virtual ~ParseTree() {
-        delete left;
-        delete right;
+        delete stats;
+        Release(left);
+        Release(right);
+    }
+
+    // once common subexpressions are merged a node can have several parents; each
+    // parent holds a reference and the last one to go deletes the node
+    void Hold() { ++refs; }
+    unsigned Refs() const { return refs; }
+    static void Release(ParseTree *t) {
+        if( t && --t->refs == 0 )
+            delete t;
     }
 
     int GetLinenum() const { return linenum; }
+    NodeKind GetKind() const { return kind; }
 
     virtual NodeType GetType() const { return ERRTYPE; }
     virtual bool ConstString() const { return false; }
     virtual bool IdentDefined() const { return false; }
     virtual bool BoolDefined() const { return false; }
+    virtual bool IntDefined() const { return false; }
+    virtual int getINTEGER() const { return 0; }
     virtual string getIDENT() const {return ""; }
+    virtual const string *getSYMBOL() const { return 0; }
+    virtual unsigned long *getVERSION() const { return 0; }
     virtual bool getBOOLEAN() const {return false; }
     virtual Value Eval(map<string, Value> &symbolMap) = 0;
 
+    // EvalInt evaluates an int-only subtree to a native int without building Values.
+    // It only reads variables, and returns false whenever the slow path is needed.
+    virtual bool EvalInt(map<string, Value> &symbolMap, int &out) { return false; }
+
+    // EvalCond evaluates a condition straight to a bool; comparisons override it.
+    // On a runtime failure it returns false and leaves the failure in fail.
+    virtual bool EvalCond(map<string, Value> &symbolMap, Value &fail) {
+        Value v = Eval(symbolMap);
+        if( v.isBoolType() ) { return v.isTrue(); }
+        fail = v.isFailure() ? v : Value::Failure("Need Boolean Type", linenum);
+        return false;
+    }
+
+    // Located stamps this node's line on a failure that does not have one yet
+    Value Located(Value v) const {
+        if( v.isFailure() && v.getErrorLine() == 0 ) { v.setErrorLine(linenum); }
+        return v;
+    }
+
     virtual string getLexeme(){
         return 0;
     }
@@ -50,98 +136,126 @@ public:
         return Value();
     };
 
-    int LeafCount() const {
-        int lc = 0;
-        if( left ) lc += left->LeafCount();
-        if ( left ) left ->Eval();
-        if( right ) lc += right->LeafCount();
-        if (right) right->Eval();
-        if( left == 0 && right == 0 )
-            lc++;
-        return lc;
-    }
-
-    int StringCount() const{
-        int stringc = 0;
-        if (left){
-            if (left -> GetType () == STRTYPE){
-                stringc++;
-            }
-            stringc += left ->StringCount();
-        }
-        if (right) {
-            if (right->GetType()== STRTYPE){
-                stringc++;
-            }
-            stringc+= right->StringCount();
+    // the counts below come from one cached traversal; see TreeStats
+    const TreeStats& Stats() const;
+    // Count does that traversal afresh, which checks that the cache is still current
+    TreeStats Count() const;
+    int LeafCount() const { return Stats().leaves; }
+    int StringCount() const { return Stats().strings; }
+    int IdentCount() const { return Stats().idents; }
+    vector<string> myVec() const { return Stats().identList; }
+    const set<string>& UniqueIdents() const { return Stats().unique; }
+
+    // must be called on every ancestor of a node whose children change
+    void InvalidateStats() { delete stats; stats = 0; }
+
+    // ShiftLines moves this node and everything under it by delta lines; the tree must
+    // not have shared nodes, which would move once per parent
+    void ShiftLines(int delta) {
+        vector<ParseTree*> work(1, this);
+        while( !work.empty() ) {
+            ParseTree *t = work.back();
+            work.pop_back();
+            t->linenum += delta;
+            if( t->right ) work.push_back(t->right);
+            if( t->left ) work.push_back(t->left);
         }
-        return stringc;
     }
+};
 
-    int IdentCount() const {
-        int ic = 0;
-        if( left) {
-            if (left -> GetType ()== IDENTTYPE){
-                idents.push_back(left->getLexeme());
-                ic++;
+inline const TreeStats& ParseTree::Stats() const
+{
+    if( stats == 0 )
+        stats = new TreeStats(Count());
+    return *stats;
+}
+
+// an explicit stack keeps the traversal safe on very long statement lists
+inline TreeStats ParseTree::Count() const
+{
+    TreeStats ts;
+    vector<const ParseTree*> work(1, this);
+    while( !work.empty() ) {
+        const ParseTree *t = work.back();
+        work.pop_back();
+
+        if( t->left == 0 && t->right == 0 )
+            ts.leaves++;
+        if( t != this ) {
+            NodeType nt = t->GetType();
+            if( nt == STRTYPE )
+                ts.strings++;
+            else if( nt == IDENTTYPE ) {
+                ts.idents++;
+                ts.identList.push_back(*t->getSYMBOL());
+                ts.unique.insert(*t->getSYMBOL());
             }
-            ic+= left ->IdentCount();
         }
-        if (right){
-            if (right->GetType()== IDENTTYPE){
-                idents.push_back(right->getLexeme());
-                ic++;
-            }
-            ic+= right->IdentCount();
-        }
-        return ic;
-    }
-    vector<string> myVec(){
-        return idents;
+
+        if( t->right ) work.push_back(t->right);
+        if( t->left ) work.push_back(t->left);
     }
-};
+
+    return ts;
+}
 
 class StmtList : public ParseTree {
 
 public:
-    StmtList(ParseTree *l, ParseTree *r) : ParseTree(0, l, r) {}
+    StmtList(ParseTree *l, ParseTree *r) : ParseTree(LISTNODE, 0, l, r) {}
+
+    // the list is unlinked one node at a time so long programs do not recurse deeply
+    virtual ~StmtList() {
+        while( right ) {
+            ParseTree *next = right;
+            right = next->right;
+            next->right = 0;
+            delete next;
+        }
+    }
+
+    // evaluation stops at the first statement that fails and hands the failure back
     virtual Value Eval(map<string, Value>&symbolMap) {
-        left->Eval(symbolMap);
-        if(right)
-        { right ->Eval(symbolMap); }
+        for( ParseTree *sl = this; sl; sl = sl->right ) {
+            if( !evalBudget.Tick() ) { return Value::Failure(evalBudget.exceeded, sl->left->GetLinenum()); }
+            Value v = sl->left->Eval(symbolMap);
+            if( v.isFailure() ) { return v; }
+        }
         return Value();
     }
 };
 
 class IfStatement : public ParseTree {
 public:
-    IfStatement(int line, ParseTree *ex, ParseTree *stmt) : ParseTree(line, ex, stmt) {}
+    IfStatement(int line, ParseTree *ex, ParseTree *stmt) : ParseTree(IFNODE, line, ex, stmt) {}
     virtual Value Eval(map<string, Value> &symbolMap){
-        Value lEval = left ->Eval(symbolMap);
-        if (lEval.isBoolType())
-        { if(lEval.getBoolean()) { return right -> Eval(symbolMap); } }
-        else { RunTimeError("Need Boolean Type"); }
-        return Value();
+        Value fail;
+        if( left->EvalCond(symbolMap, fail) ) { return right->Eval(symbolMap); }
+        return fail;
     }
 };
 
 class Assignment : public ParseTree {
+    JitSite jit;
+
 public:
-    Assignment(int line, ParseTree *lhs, ParseTree *rhs) : ParseTree(line, lhs, rhs) {}
+    Assignment(int line, ParseTree *lhs, ParseTree *rhs) : ParseTree(ASSIGNNODE, line, lhs, rhs) {}
     virtual Value Eval(map<string, Value> &symbolMap)
     {
+        int native;
+        if( jitEnabled && left->IdentDefined() && jit.Run(right, symbolMap, native) ) {
+            symbolMap[*left->getSYMBOL()] = Value(native);
+            ++*left->getVERSION();
+            return Value();
+        }
+
         if (left->IdentDefined()) {
-            if(!symbolMap.empty() && symbolMap.count(left->getIDENT())) {
-                Value reval = right->Eval(symbolMap);
-                string lEval = left->getIDENT();
-                symbolMap[lEval] = reval;
-            } else {
-                Value reval = right->Eval(symbolMap);
-                string lEval = left->getIDENT();
-                symbolMap.insert (std::pair<string, Value>(lEval, reval));
-            }
+            Value reval = right->Eval(symbolMap);
+            if( reval.isFailure() ) { return reval; }
+            symbolMap[*left->getSYMBOL()] = reval;
+            ++*left->getVERSION();
         }
-        else { RunTimeError("IDENT Type Expected"); }
+        else { return Value::Failure("IDENT Type Expected", GetLinenum()); }
         return Value();
     }
 };
@@ -149,11 +263,24 @@ public:
 
 
 class PrintStatement : public ParseTree {
+    JitSite jit;
+
 public:
-    PrintStatement(int line, ParseTree *e) : ParseTree(line, e) {}
+    PrintStatement(int line, ParseTree *e) : ParseTree(PRINTNODE, line, e) {}
     virtual Value Eval(map<string, Value> &symbolMap)
     {
-        cout << left->Eval(symbolMap) << '\n';
+        int native;
+        if( jitEnabled && jit.Run(left, symbolMap, native) ) {
+            Value v(native);
+            if( !evalBudget.Output(v.PrintedSize() + 1) ) { return Value::Failure(evalBudget.exceeded, GetLinenum()); }
+            *printOut << v << '\n';
+            return Value();
+        }
+
+        Value v = left->Eval(symbolMap);
+        if( v.isFailure() ) { return v; }
+        if( !evalBudget.Output(v.PrintedSize() + 1) ) { return Value::Failure(evalBudget.exceeded, GetLinenum()); }
+        *printOut << v << '\n';
         return Value();
     }
 
@@ -161,142 +288,324 @@ public:
 
 class PlusExpr : public ParseTree {
 public:
-    PlusExpr(int line, ParseTree *l, ParseTree *r) : ParseTree(line,l,r) {}
-    virtual Value Eval (map<string, Value> &symbolMap) { return left -> Eval(symbolMap) + right ->Eval(symbolMap); }
+    PlusExpr(int line, ParseTree *l, ParseTree *r) : ParseTree(PLUSNODE, line,l,r) {}
+    virtual Value Eval(map<string, Value> &symbolMap) {
+        Value l = left->Eval(symbolMap);
+        if( l.isFailure() ) { return l; }
+        return Located(l + right->Eval(symbolMap));
+    }
+    virtual bool EvalInt(map<string, Value> &symbolMap, int &out) {
+        int l, r;
+        if( !left->EvalInt(symbolMap, l) || !right->EvalInt(symbolMap, r) ) { return false; }
+        out = l + r;
+        return true;
+    }
 };
 
 class MinusExpr : public ParseTree {
 public:
-    MinusExpr(int line, ParseTree *l, ParseTree *r) : ParseTree(line,l,r) {}
-    virtual Value Eval(map<string, Value> &symbolMap) { return left->Eval(symbolMap) - right->Eval(symbolMap); }
+    MinusExpr(int line, ParseTree *l, ParseTree *r) : ParseTree(MINUSNODE, line,l,r) {}
+    virtual Value Eval(map<string, Value> &symbolMap) {
+        Value l = left->Eval(symbolMap);
+        if( l.isFailure() ) { return l; }
+        return Located(l - right->Eval(symbolMap));
+    }
+    virtual bool EvalInt(map<string, Value> &symbolMap, int &out) {
+        int l, r;
+        if( !left->EvalInt(symbolMap, l) || !right->EvalInt(symbolMap, r) ) { return false; }
+        out = l - r;
+        return true;
+    }
 };
 
 class TimesExpr : public ParseTree {
 public:
-    TimesExpr(int line, ParseTree *l, ParseTree *r) : ParseTree(line,l,r) {}
-    virtual Value Eval(map<string, Value> &symbolMap) { return left->Eval(symbolMap) * right->Eval(symbolMap); }
+    TimesExpr(int line, ParseTree *l, ParseTree *r) : ParseTree(TIMESNODE, line,l,r) {}
+    virtual Value Eval(map<string, Value> &symbolMap) {
+        Value l = left->Eval(symbolMap);
+        if( l.isFailure() ) { return l; }
+        return Located(l * right->Eval(symbolMap));
+    }
+    virtual bool EvalInt(map<string, Value> &symbolMap, int &out) {
+        int l, r;
+        if( !left->EvalInt(symbolMap, l) || !right->EvalInt(symbolMap, r) ) { return false; }
+        out = l * r;
+        return true;
+    }
 };
 
 class DivideExpr : public ParseTree {
 public:
-    DivideExpr(int line, ParseTree *l, ParseTree *r) : ParseTree(line,l,r) {}
-    virtual Value Eval(map<string, Value> &symbolMap) { return left->Eval(symbolMap) / right->Eval(symbolMap); }
+    DivideExpr(int line, ParseTree *l, ParseTree *r) : ParseTree(DIVIDENODE, line,l,r) {}
+    virtual Value Eval(map<string, Value> &symbolMap) {
+        Value l = left->Eval(symbolMap);
+        if( l.isFailure() ) { return l; }
+        return Located(l / right->Eval(symbolMap));
+    }
+    virtual bool EvalInt(map<string, Value> &symbolMap, int &out) {
+        int l, r;
+        if( !left->EvalInt(symbolMap, l) || !right->EvalInt(symbolMap, r) || r == 0 ) { return false; }
+        out = Quotient(l, r);
+        return true;
+    }
 };
 
 class LogicAndExpr : public ParseTree {
 public:
-    LogicAndExpr(int line, ParseTree *l, ParseTree *r) : ParseTree(line,l,r) {}
+    LogicAndExpr(int line, ParseTree *l, ParseTree *r) : ParseTree(ANDNODE, line,l,r) {}
     virtual Value Eval(map<string, Value> &symbolMap) {
         Value lEval = left->Eval(symbolMap);
+        if( lEval.isFailure() ) { return lEval; }
         Value rEval = right->Eval(symbolMap);
+        if( rEval.isFailure() ) { return rEval; }
         if (lEval.isBoolType() && rEval.isBoolType()){ return lEval.isTrue() && rEval.isTrue(); }
-        else { RunTimeError("BOOL Type expected"); }
-        return Value();
+        else { return Value::Failure("BOOL Type expected", GetLinenum()); }
     }
 };
 
 class LogicOrExpr : public ParseTree {
 public:
-    LogicOrExpr(int line, ParseTree *l, ParseTree *r) : ParseTree(line,l,r) {}
+    LogicOrExpr(int line, ParseTree *l, ParseTree *r) : ParseTree(ORNODE, line,l,r) {}
     virtual Value Eval(map<string, Value> &symbolMap)
     {
         Value rEval = right->Eval(symbolMap);
+        if( rEval.isFailure() ) { return rEval; }
         Value lEval = left->Eval(symbolMap);
+        if( lEval.isFailure() ) { return lEval; }
         if (lEval.isBoolType() || rEval.isBoolType()) { return lEval.isTrue() || rEval.isTrue(); }
-        else { RunTimeError("BOOL Type Expected"); }
-        return Value();
+        else { return Value::Failure("BOOL Type Expected", GetLinenum()); }
     }
 };
 
+// CondCompare is the fused compare-and-branch used by the comparison nodes. When both
+// operands are ints (constants, variables or int arithmetic over them) they are compared
+// natively; otherwise they are compared through the Value operator. A left int already
+// computed by the fast path is reused, so no operand is evaluated twice.
+template <class IntCmp>
+inline bool CondCompare(const ParseTree *self, map<string, Value> &symbolMap,
+                        Value (Value::*slow)(const Value&), Value &fail)
+{
+    int li, ri;
+    bool leftInt = self->left->EvalInt(symbolMap, li);
+    if( leftInt && self->right->EvalInt(symbolMap, ri) )
+        return IntCmp()(li, ri);
+
+    Value lv = leftInt ? Value(li) : self->left->Eval(symbolMap);
+    if( lv.isFailure() ) { fail = lv; return false; }
+    Value res = (lv.*slow)(self->right->Eval(symbolMap));
+    if( res.isFailure() ) { fail = self->Located(res); return false; }
+    return res.isTrue();
+}
+
 class EqExpr : public ParseTree {
 public:
-    EqExpr(int line, ParseTree *l, ParseTree *r) : ParseTree(line,l,r) {}
-    virtual Value Eval(map<string, Value> &symbolMap)
-    {
-        return left->Eval(symbolMap) == right->Eval(symbolMap);
+    EqExpr(int line, ParseTree *l, ParseTree *r) : ParseTree(EQNODE, line,l,r) {}
+    virtual Value Eval(map<string, Value> &symbolMap) {
+        Value fail;
+        bool b = EvalCond(symbolMap, fail);
+        return fail.isFailure() ? fail : Value(b);
+    }
+    virtual bool EvalCond(map<string, Value> &symbolMap, Value &fail) {
+        return CondCompare<std::equal_to<int>>(this, symbolMap, &Value::operator==, fail);
     }
 };
 
 class NEqExpr : public ParseTree {
 public:
-    NEqExpr(int line, ParseTree *l, ParseTree *r) : ParseTree(line,l,r) {}
-    virtual Value Eval(map<string, Value> &symbolMap){ return left->Eval(symbolMap) != right->Eval(symbolMap); }
+    NEqExpr(int line, ParseTree *l, ParseTree *r) : ParseTree(NEQNODE, line,l,r) {}
+    virtual Value Eval(map<string, Value> &symbolMap) {
+        Value fail;
+        bool b = EvalCond(symbolMap, fail);
+        return fail.isFailure() ? fail : Value(b);
+    }
+    virtual bool EvalCond(map<string, Value> &symbolMap, Value &fail) {
+        return CondCompare<std::not_equal_to<int>>(this, symbolMap, &Value::operator!=, fail);
+    }
 };
 
 class LtExpr : public ParseTree {
 public:
-    LtExpr(int line, ParseTree *l, ParseTree *r) : ParseTree(line,l,r) {}
-    virtual Value Eval(map<string, Value> &symbolMap) { return left->Eval(symbolMap) < right->Eval(symbolMap); }
+    LtExpr(int line, ParseTree *l, ParseTree *r) : ParseTree(LTNODE, line,l,r) {}
+    virtual Value Eval(map<string, Value> &symbolMap) {
+        Value fail;
+        bool b = EvalCond(symbolMap, fail);
+        return fail.isFailure() ? fail : Value(b);
+    }
+    virtual bool EvalCond(map<string, Value> &symbolMap, Value &fail) {
+        return CondCompare<std::less<int>>(this, symbolMap, &Value::operator<, fail);
+    }
 };
 
 
 
 class LEqExpr : public ParseTree {
 public:
-    LEqExpr(int line, ParseTree *l, ParseTree *r) : ParseTree(line,l,r) {}
-    virtual Value Eval(map<string, Value> &symbolMap){ return left->Eval(symbolMap) <= right->Eval(symbolMap); }
+    LEqExpr(int line, ParseTree *l, ParseTree *r) : ParseTree(LEQNODE, line,l,r) {}
+    virtual Value Eval(map<string, Value> &symbolMap) {
+        Value fail;
+        bool b = EvalCond(symbolMap, fail);
+        return fail.isFailure() ? fail : Value(b);
+    }
+    virtual bool EvalCond(map<string, Value> &symbolMap, Value &fail) {
+        return CondCompare<std::less_equal<int>>(this, symbolMap, &Value::operator<=, fail);
+    }
 };
 
 class GtExpr : public ParseTree {
 public:
-    GtExpr(int line, ParseTree *l, ParseTree *r) : ParseTree(line,l,r) {}
-    virtual Value Eval(map<string, Value> &symbolMap){ return left->Eval(symbolMap) > right->Eval(symbolMap); }
+    GtExpr(int line, ParseTree *l, ParseTree *r) : ParseTree(GTNODE, line,l,r) {}
+    virtual Value Eval(map<string, Value> &symbolMap) {
+        Value fail;
+        bool b = EvalCond(symbolMap, fail);
+        return fail.isFailure() ? fail : Value(b);
+    }
+    virtual bool EvalCond(map<string, Value> &symbolMap, Value &fail) {
+        return CondCompare<std::greater<int>>(this, symbolMap, &Value::operator>, fail);
+    }
 };
 
 class GEqExpr : public ParseTree {
 public:
-    GEqExpr(int line, ParseTree *l, ParseTree *r) : ParseTree(line,l,r) {}
-    virtual Value Eval(map<string, Value> &symbolMap) { return left->Eval(symbolMap) >= right->Eval(symbolMap); }
+    GEqExpr(int line, ParseTree *l, ParseTree *r) : ParseTree(GEQNODE, line,l,r) {}
+    virtual Value Eval(map<string, Value> &symbolMap) {
+        Value fail;
+        bool b = EvalCond(symbolMap, fail);
+        return fail.isFailure() ? fail : Value(b);
+    }
+    virtual bool EvalCond(map<string, Value> &symbolMap, Value &fail) {
+        return CondCompare<std::greater_equal<int>>(this, symbolMap, &Value::operator>=, fail);
+    }
 };
 
 class IConst : public ParseTree {
     int val;
 
 public:
-    IConst(int l, int i) : ParseTree(l), val(i) {}
-    IConst(Token& t) : ParseTree(t.GetLinenum()) { val = stoi(t.GetLexeme()); }
+    IConst(int l, int i) : ParseTree(ICONSTNODE, l), val(i) {}
+    // the lexer has already checked the range, so this cannot fail
+    IConst(const Token& t) : ParseTree(ICONSTNODE, t.GetLinenum()), val(0) {
+        const string& lex = t.GetLexeme();
+        std::from_chars(lex.data(), lex.data() + lex.size(), val);
+    }
     NodeType GetType() const { return INTTYPE; }
+    bool IntDefined() const { return true; }
+    int getINTEGER() const { return val; }
     virtual Value Eval(map<string, Value> &symbolMap){ return Value(val); }
+    virtual bool EvalInt(map<string, Value> &symbolMap, int &out) { out = val; return true; }
 };
 
 class BoolConst : public ParseTree {
     bool val;
 
 public:
-    BoolConst(Token& t, bool val) : ParseTree(t.GetLinenum()), val(val) {}
+    BoolConst(const Token& t, bool val) : ParseTree(BCONSTNODE, t.GetLinenum()), val(val) {}
 
     NodeType GetType() const { return BOOLTYPE; }
     bool BoolDefined() const { return true; }
     bool getBOOLEAN() const {return val; }
     virtual Value Eval(map<string, Value> &symbolMap){ return Value(val); }
+    virtual bool EvalCond(map<string, Value> &symbolMap, Value &fail) { return val; }
 };
 
+// string constants and identifiers point into the shared string pool
 class SConst : public ParseTree {
-    string val;
+    const string *val;
 
 public:
-    SConst(Token& t) : ParseTree(t.GetLinenum()) { val = t.GetLexeme(); }
+    SConst(const Token& t) : ParseTree(SCONSTNODE, t.GetLinenum()) {
+        val = t.GetSymbol() ? t.GetSymbol() : Intern(t.GetLexeme());
+    }
     NodeType GetType() const { return STRTYPE; }
     bool ConstString() const { return true; }
-    virtual Value Eval(map<string, Value> &symbolMap) { return Value(val);}
+    const string *getSTRING() const { return val; }
+    virtual Value Eval(map<string, Value> &symbolMap) { return Value(*val);}
 };
 
 class Ident : public ParseTree {
-    string id;
+    const string *id;
+    unsigned long *version;
     NodeType GetType() const { return IDENTTYPE; }
 
 public:
-    Ident(Token& t) : ParseTree(t.GetLinenum()), id(t.GetLexeme()) {}
-    string ident = id;
-    string getLexeme() { return ident; };
+    Ident(const Token& t) : ParseTree(IDENTNODE, t.GetLinenum()) {
+        id = t.GetSymbol() ? t.GetSymbol() : Intern(t.GetLexeme());
+        version = currentPool->Version(id);
+    }
+    string getLexeme() { return *id; };
     bool IdentDefined() const { return true; }
-    string getIDENT() const { return id; }
+    string getIDENT() const { return *id; }
+    const string *getSYMBOL() const { return id; }
+    unsigned long *getVERSION() const { return version; }
+
+    // two identifiers name the same variable exactly when they share a pool entry
+    bool SameIdent(const ParseTree *other) const { return other->getSYMBOL() == id; }
 
     virtual Value Eval(map<string, Value> &symbolMap)
     {
-        if (!symbolMap.empty() && symbolMap.count(id)) { return symbolMap[id]; }
-        else { RunTimeError(""); }
-        return Value();
+        auto it = symbolMap.find(*id);
+        if (it != symbolMap.end()) { return it->second; }
+        else { return Value::Failure("", GetLinenum()); }
+    }
+
+    virtual bool EvalInt(map<string, Value> &symbolMap, int &out)
+    {
+        auto it = symbolMap.find(*id);
+        if( it == symbolMap.end() || !it->second.isIntType() ) { return false; }
+        out = it->second.getInteger();
+        return true;
+    }
+};
+
+// MemoExpr caches the value of a pure subexpression. The cached value is reused while
+// it was computed against the same symbol table and every variable the subexpression
+// reads still has the version it had then. Failures are never cached.
+class MemoExpr : public ParseTree {
+    vector<unsigned long*>	versions;
+    vector<unsigned long>	seen;
+    StringPool			*pool;		// where the versions live
+    map<string, Value>	*owner;
+    unsigned long		generation;
+    Value				cached;
+    bool				valid;
+
+    bool Fresh(map<string, Value> &symbolMap) const {
+        if( !valid || owner != &symbolMap || generation != pool->Generation() )
+            return false;
+        for( size_t i = 0; i < versions.size(); i++ )
+            if( *versions[i] != seen[i] )
+                return false;
+        return true;
+    }
+
+public:
+    MemoExpr(ParseTree *e, const vector<unsigned long*>& versions)
+            : ParseTree(MEMONODE, e->GetLinenum(), e), versions(versions), seen(versions.size()),
+              pool(currentPool), owner(0), generation(0), valid(false) {}
+
+    NodeType GetType() const { return left->GetType(); }
+
+    virtual Value Eval(map<string, Value> &symbolMap) {
+        if( Fresh(symbolMap) ) { return cached; }
+
+        Value v = left->Eval(symbolMap);
+        if( v.isFailure() ) { return v; }
+
+        cached = v;
+        valid = true;
+        owner = &symbolMap;
+        generation = pool->Generation();
+        for( size_t i = 0; i < versions.size(); i++ )
+            seen[i] = *versions[i];
+        return v;
+    }
+
+    virtual bool EvalInt(map<string, Value> &symbolMap, int &out) {
+        if( Fresh(symbolMap) ) {
+            if( !cached.isIntType() ) { return false; }
+            out = cached.getInteger();
+            return true;
+        }
+        return left->EvalInt(symbolMap, out);
     }
 };
 
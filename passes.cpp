@@ -0,0 +1,575 @@
+#include <chrono>
+#include <iomanip>
+#include <algorithm>
+#include <unordered_map>
+#include "passes.h"
+#include "visitor.h"
+
+bool PassManager::Run(ParseTree *&root)
+{
+    bool changed = false;
+    for( auto& p : passes ) {
+        auto start = std::chrono::steady_clock::now();
+        bool c = p->Run(root);
+        std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+
+        timings.push_back( Timing{ p->Name(), took.count(), c, p->Summary() } );
+        changed = changed || c;
+    }
+    return changed;
+}
+
+void PassManager::Report(ostream& out) const
+{
+    double total = 0;
+    for( auto& t : timings ) {
+        out << std::setw(20) << std::left << t.name
+            << std::setw(12) << std::right << std::fixed << std::setprecision(3) << t.ms << " ms"
+            << (t.changed ? "  changed" : "")
+            << (t.summary.size() ? "  (" + t.summary + ")" : "") << endl;
+        total += t.ms;
+    }
+    out << std::setw(20) << std::left << "total"
+        << std::setw(12) << std::right << std::fixed << std::setprecision(3) << total << " ms" << endl;
+}
+
+// PurityCheck finds whether an expression can be cached and which versions it reads
+class PurityCheck : public TreeVisitor<PurityCheck> {
+public:
+    bool	pure = true;
+    int		ops = 0;
+    vector<unsigned long*>	versions;
+
+    void VisitNode(ParseTree *t) {
+        ops++;
+        VisitChildren(t);
+    }
+    void VisitAssignment(Assignment *t) { pure = false; }
+    void VisitMemo(MemoExpr *t) { pure = false; }
+    void VisitIConst(IConst *t) {}
+    void VisitBoolConst(BoolConst *t) {}
+    void VisitSConst(SConst *t) {}
+    void VisitIdent(Ident *t) {
+        if( find(versions.begin(), versions.end(), t->getVERSION()) == versions.end() )
+            versions.push_back(t->getVERSION());
+    }
+};
+
+void MemoizePass::Expression(ParseTree *&expr)
+{
+    PurityCheck pc;
+    pc.Visit(expr);
+
+    if( pc.pure ) {
+        if( pc.ops > 0 && pc.versions.size() <= MAXREADS ) {
+            expr = new MemoExpr(expr, pc.versions);
+            wrapped++;
+        }
+        return;
+    }
+
+    // an assignment somewhere inside: look for cacheable pieces below it
+    if( expr->GetKind() == ASSIGNNODE ) {
+        Expression(expr->right);
+    }
+    else {
+        if( expr->left ) Expression(expr->left);
+        if( expr->right ) Expression(expr->right);
+    }
+    expr->InvalidateStats();
+}
+
+void MemoizePass::Statement(ParseTree *&stmt)
+{
+    switch( stmt->GetKind() ) {
+        case IFNODE:
+            Expression(stmt->left);
+            Statement(stmt->right);
+            break;
+        case ASSIGNNODE:
+            Expression(stmt->right);
+            break;
+        case PRINTNODE:
+            Expression(stmt->left);
+            break;
+        default:
+            Expression(stmt);
+            break;
+    }
+    stmt->InvalidateStats();
+}
+
+bool MemoizePass::Run(ParseTree *&root)
+{
+    int before = wrapped;
+    if( root->GetKind() == LISTNODE ) {
+        for( ParseTree *sl = root; sl; sl = sl->right ) {
+            Statement(sl->left);
+            sl->InvalidateStats();
+        }
+    }
+    else {
+        Statement(root);
+    }
+    return wrapped != before;
+}
+
+// ConsKey identifies a node by its kind, line, payload and children. Children are
+// already merged when their parent is looked up, so comparing their addresses compares
+// the whole subtree; a child that has been wrapped in a MemoExpr counts as the node
+// inside it.
+struct ConsKey {
+    NodeKind	kind;
+    int			line;
+    const ParseTree	*left, *right;
+    const void	*symbol;	// the pooled string of an identifier or string constant
+    int			val;		// the value of an int or bool constant
+
+    bool operator==(const ConsKey& k) const {
+        return kind == k.kind && line == k.line && left == k.left && right == k.right
+               && symbol == k.symbol && val == k.val;
+    }
+};
+
+struct ConsHash {
+    static size_t Mix(size_t h, size_t v) {
+        h ^= v + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+        return h;
+    }
+    size_t operator()(const ConsKey& k) const {
+        size_t h = Mix(k.kind, (size_t)k.left);
+        h = Mix(h, (size_t)k.right);
+        h = Mix(h, (size_t)k.symbol);
+        return Mix(h, (size_t)(unsigned)k.line << 32 | (unsigned)k.val);
+    }
+};
+
+// ReadVersions collects the versions of the variables an expression reads
+class ReadVersions : public TreeVisitor<ReadVersions> {
+public:
+    vector<unsigned long*>	versions;
+
+    void VisitNode(ParseTree *t) { VisitChildren(t); }
+    void VisitIdent(Ident *t) {
+        if( find(versions.begin(), versions.end(), t->getVERSION()) == versions.end() )
+            versions.push_back(t->getVERSION());
+    }
+};
+
+// HashCons replaces each pure subexpression by the first one seen that is equal to it.
+// A node is only merged when all its children were, so assignments and anything above
+// them stay as they are. The first time an operator node is merged it is wrapped in a
+// MemoExpr, and the edge it was first found on is pointed at the MemoExpr too. Nodes on
+// earlier lines can never match again, so the table is emptied whenever the line moves
+// on and stays small.
+class HashCons {
+    struct Entry {
+        ParseTree	*node;
+        ParseTree	**first;	// the edge the node was first found on
+        ParseTree	*memo;
+    };
+
+    std::unordered_map<ConsKey, Entry, ConsHash>	table;
+    int		line = 0;	// the latest line in the table
+
+    static const ParseTree *Identity(const ParseTree *t) {
+        return t && t->GetKind() == MEMONODE ? t->left : t;
+    }
+
+public:
+    int		merged = 0;
+    int		shared = 0;
+
+    // Cons merges the subtree on edge and says whether the result is in the table
+    bool Cons(ParseTree *&edge);
+};
+
+bool HashCons::Cons(ParseTree *&edge)
+{
+    ParseTree *t = edge;
+    NodeKind k = t->GetKind();
+    bool lc = true, rc = true;
+    if( t->left && k != ASSIGNNODE )
+        lc = Cons(t->left);
+    if( t->right )
+        rc = Cons(t->right);
+
+    if( k == LISTNODE || k == IFNODE || k == ASSIGNNODE || k == PRINTNODE || k == MEMONODE )
+        return false;
+    if( !lc || !rc )
+        return false;
+
+    ConsKey key{ k, t->GetLinenum(), Identity(t->left), Identity(t->right), 0, 0 };
+    if( k == IDENTNODE )
+        key.symbol = t->getSYMBOL();
+    else if( k == SCONSTNODE )
+        key.symbol = static_cast<SConst*>(t)->getSTRING();
+    else if( k == ICONSTNODE )
+        key.val = t->getINTEGER();
+    else if( k == BCONSTNODE )
+        key.val = t->getBOOLEAN();
+
+    if( key.line > line ) {
+        table.clear();
+        line = key.line;
+    }
+    auto it = table.find(key);
+    if( it == table.end() ) {
+        table.emplace(key, Entry{ t, &edge, 0 });
+        t->InvalidateStats();
+        return true;
+    }
+
+    Entry& e = it->second;
+    if( e.node == t )
+        return true;
+    if( e.memo == 0 && e.node->left ) {
+        ReadVersions rv;
+        rv.Visit(e.node);
+        if( rv.versions.size() <= MemoizePass::MAXREADS ) {
+            // the first edge's reference moves to the MemoExpr
+            e.memo = new MemoExpr(e.node, rv.versions);
+            *e.first = e.memo;
+            shared++;
+        }
+    }
+    ParseTree *use = e.memo ? e.memo : e.node;
+    use->Hold();
+    ParseTree::Release(t);
+    edge = use;
+    merged++;
+    return true;
+}
+
+bool CsePass::Run(ParseTree *&root)
+{
+    int before = merged + shared;
+    HashCons hc;
+
+    if( root->GetKind() == LISTNODE ) {
+        for( ParseTree *sl = root; sl; sl = sl->right ) {
+            hc.Cons(sl->left);
+            sl->InvalidateStats();
+        }
+    }
+    else {
+        hc.Cons(root);
+    }
+    merged += hc.merged;
+    shared += hc.shared;
+    return merged + shared != before;
+}
+
+// what an expression is sure to evaluate to; NOTSURE covers anything that might fail
+enum SureType { NOTSURE, SUREINT, SUREBOOL, SURESTRING };
+
+typedef map<const string*, SureType> TypeEnv;
+
+// SureTypes works out the type of an expression given the variables that are known to
+// hold a value of some type. An operator is only sure when the Value operator cannot
+// fail for those operand types.
+class SureTypes : public TreeVisitor<SureTypes, SureType> {
+    const TypeEnv& env;
+
+public:
+    SureTypes(const TypeEnv& env) : env(env) {}
+
+    SureType VisitNode(ParseTree *t) { return NOTSURE; }
+    SureType VisitIConst(IConst *t) { return SUREINT; }
+    SureType VisitBoolConst(BoolConst *t) { return SUREBOOL; }
+    SureType VisitSConst(SConst *t) { return SURESTRING; }
+    SureType VisitMemo(MemoExpr *t) { return Visit(t->left); }
+    SureType VisitIdent(Ident *t) {
+        auto it = env.find(t->getSYMBOL());
+        return it == env.end() ? NOTSURE : it->second;
+    }
+
+    SureType VisitArith(ParseTree *t) {
+        SureType l = Visit(t->left);
+        SureType r = Visit(t->right);
+        if( l == NOTSURE || r == NOTSURE )
+            return NOTSURE;
+
+        bool constLeft = t->left->GetKind() == ICONSTNODE;
+        bool constRight = t->right->GetKind() == ICONSTNODE;
+        switch( t->GetKind() ) {
+            case PLUSNODE:
+                return l == r && l != SUREBOOL ? l : NOTSURE;
+            case MINUSNODE:
+                return l == SUREINT && r == SUREINT ? SUREINT : NOTSURE;
+            case TIMESNODE:
+                if( l == SUREINT && r == SUREINT )
+                    return SUREINT;
+                // unary minus on a bool is how the parser spells not
+                if( constLeft && t->left->getINTEGER() == -1 && r == SUREBOOL )
+                    return SUREBOOL;
+                if( constLeft && t->left->getINTEGER() >= 0 && r == SURESTRING )
+                    return SURESTRING;
+                if( constRight && t->right->getINTEGER() >= 0 && l == SURESTRING )
+                    return SURESTRING;
+                return NOTSURE;
+            default: {
+                // only a constant divisor is sure not to be zero
+                int d = constRight ? t->right->getINTEGER() : 0;
+                return l == SUREINT && r == SUREINT && d != 0 ? SUREINT : NOTSURE;
+            }
+        }
+    }
+
+    SureType VisitLogic(ParseTree *t) {
+        return Visit(t->left) == SUREBOOL && Visit(t->right) == SUREBOOL ? SUREBOOL : NOTSURE;
+    }
+
+    SureType VisitCompare(ParseTree *t) {
+        SureType l = Visit(t->left);
+        SureType r = Visit(t->right);
+        if( l == NOTSURE || l != r )
+            return NOTSURE;
+        if( l == SUREBOOL && t->GetKind() != EQNODE && t->GetKind() != NEQNODE )
+            return NOTSURE;
+        return SUREBOOL;
+    }
+};
+
+// Reads collects the variables an expression reads
+class Reads : public TreeVisitor<Reads> {
+    set<const string*>& live;
+
+public:
+    Reads(set<const string*>& live) : live(live) {}
+
+    void VisitNode(ParseTree *t) { VisitChildren(t); }
+    void VisitIdent(Ident *t) { live.insert(t->getSYMBOL()); }
+};
+
+// Assigned collects every variable the program assigns
+class Assigned : public TreeVisitor<Assigned> {
+public:
+    set<const string*>	vars;
+
+    void VisitStmtList(StmtList *t) { VisitStatements(t); }
+    void VisitIf(IfStatement *t) { Visit(t->right); }
+    void VisitAssignment(Assignment *t) { vars.insert(t->left->getSYMBOL()); }
+};
+
+// Stored collects the variables assigned inside an expression, as in print (x = 1)
+class Stored : public TreeVisitor<Stored> {
+    TypeEnv& env;
+
+public:
+    Stored(TypeEnv& env) : env(env) {}
+
+    void VisitNode(ParseTree *t) { VisitChildren(t); }
+    void VisitAssignment(Assignment *t) {
+        env.erase(t->left->getSYMBOL());
+        Visit(t->right);
+    }
+};
+
+// Constant is 1 or 0 for a condition built only from constants that evaluates to True or
+// False, and -1 otherwise. Statements run at most once, so evaluating it now costs no
+// more than the run would.
+static int Constant(ParseTree *cond)
+{
+    set<const string*> reads;
+    Reads r(reads);
+    r.Visit(cond);
+    if( !reads.empty() )
+        return -1;
+
+    map<string, Value> none;
+    Value v = cond->Eval(none);
+    if( !v.isBoolType() )
+        return -1;
+    return v.isTrue();
+}
+
+// Dead is true when nothing in stmt can ever run, and dropping it cannot lose a failure
+static bool Dead(ParseTree *stmt, const TypeEnv& env)
+{
+    if( stmt->GetKind() != IFNODE )
+        return false;
+    int c = Constant(stmt->left);
+    if( c >= 0 )
+        return c == 0 || Dead(stmt->right, env);
+    return SureTypes(env).Visit(stmt->left) == SUREBOOL && Dead(stmt->right, env);
+}
+
+// Fold replaces ifs with a constant True condition by their body. stmt must not be Dead.
+static ParseTree *Fold(ParseTree *stmt, const TypeEnv& env, int& folded)
+{
+    if( stmt->GetKind() != IFNODE )
+        return stmt;
+
+    if( Constant(stmt->left) == 1 ) {
+        ParseTree *body = stmt->right;
+        stmt->right = 0;
+        delete stmt;
+        folded++;
+        return Fold(body, env, folded);
+    }
+
+    // a dead body under a condition that might fail has to stay as it is
+    if( !Dead(stmt->right, env) ) {
+        stmt->right = Fold(stmt->right, env, folded);
+        stmt->InvalidateStats();
+    }
+    return stmt;
+}
+
+// Forward records which assignments are sure to succeed and what types variables are
+// sure to have afterwards. A conditional assignment only keeps a type that agrees, and
+// a variable assigned inside an expression loses its type.
+static void Forward(ParseTree *stmt, TypeEnv& env, set<const ParseTree*>& safe, bool conditional)
+{
+    switch( stmt->GetKind() ) {
+        case IFNODE:
+            Stored(env).Visit(stmt->left);
+            Forward(stmt->right, env, safe, true);
+            break;
+        case ASSIGNNODE: {
+            Stored(env).Visit(stmt->right);
+            SureType t = SureTypes(env).Visit(stmt->right);
+            if( t != NOTSURE )
+                safe.insert(stmt);
+            const string *sym = stmt->left->getSYMBOL();
+            auto it = env.find(sym);
+            if( t == NOTSURE || (conditional && (it == env.end() || it->second != t)) )
+                env.erase(sym);
+            else
+                env[sym] = t;
+            break;
+        }
+        default:
+            Stored(env).Visit(stmt);
+            break;
+    }
+}
+
+// Sweep walks a statement backwards with the set of variables read later, deleting
+// assignments to variables that are not. It returns 0 when the whole statement went,
+// which only happens when removable is set.
+ParseTree *DeadCodePass::Sweep(ParseTree *stmt, set<const string*>& live, bool removable)
+{
+    switch( stmt->GetKind() ) {
+        case ASSIGNNODE: {
+            const string *sym = stmt->left->getSYMBOL();
+            if( removable && live.count(sym) == 0 && safe.count(stmt) ) {
+                delete stmt;
+                deadStores++;
+                return 0;
+            }
+            live.erase(sym);
+            Reads(live).Visit(stmt->right);
+            return stmt;
+        }
+
+        case IFNODE: {
+            set<const string*> inner = live;
+            bool sure = sureConds.count(stmt) != 0;
+            ParseTree *body = Sweep(stmt->right, inner, removable && sure);
+            if( body == 0 ) {
+                stmt->right = 0;
+                delete stmt;
+                deadIfs++;
+                return 0;
+            }
+            stmt->right = body;
+            stmt->InvalidateStats();
+            live.insert(inner.begin(), inner.end());
+            Reads(live).Visit(stmt->left);
+            return stmt;
+        }
+
+        default:
+            Reads(live).Visit(stmt);
+            return stmt;
+    }
+}
+
+bool DeadCodePass::Run(ParseTree *&root)
+{
+    int before = folded + deadIfs + deadStores;
+    safe.clear();
+    sureConds.clear();
+
+    vector<ParseTree*> nodes;
+    if( root->GetKind() == LISTNODE ) {
+        for( ParseTree *sl = root; sl; sl = sl->right )
+            nodes.push_back(sl);
+    }
+    else {
+        root = new StmtList(root, 0);
+        nodes.push_back(root);
+    }
+
+    // forward: fold constant conditions and learn which assignments cannot fail.
+    // The program always keeps at least one statement.
+    TypeEnv env;
+    size_t kept = 0;
+    for( size_t i = 0; i < nodes.size(); i++ ) {
+        ParseTree *&stmt = nodes[i]->left;
+        if( Dead(stmt, env) && (kept > 0 || i + 1 < nodes.size()) ) {
+            delete stmt;
+            stmt = 0;
+            deadIfs++;
+            continue;
+        }
+        kept++;
+        if( !Dead(stmt, env) )
+            stmt = Fold(stmt, env, folded);
+        for( ParseTree *s = stmt; s->GetKind() == IFNODE; s = s->right ) {
+            if( SureTypes(env).Visit(s->left) == SUREBOOL )
+                sureConds.insert(s);
+        }
+        Forward(stmt, env, safe, false);
+    }
+
+    // backward: drop stores that are never read
+    set<const string*> live;
+    if( keepFinalStores ) {
+        Assigned a;
+        for( ParseTree *n : nodes ) {
+            if( n->left )
+                a.Visit(n->left);
+        }
+        live = a.vars;
+    }
+    size_t first = 0;
+    while( nodes[first]->left == 0 )
+        first++;
+    size_t later = 0;
+    for( size_t i = nodes.size(); i-- > first; ) {
+        ParseTree *&stmt = nodes[i]->left;
+        if( stmt == 0 )
+            continue;
+        stmt = Sweep(stmt, live, later > 0 || i > first);
+        if( stmt )
+            later++;
+    }
+
+    // relink what is left
+    ParseTree *head = 0;
+    ParseTree *tail = 0;
+    for( ParseTree *n : nodes ) {
+        n->right = 0;
+        if( n->left == 0 ) {
+            delete n;
+            continue;
+        }
+        n->InvalidateStats();
+        if( tail )
+            tail->right = n;
+        else
+            head = n;
+        tail = n;
+    }
+    root = head;
+    return folded + deadIfs + deadStores != before;
+}
+
+string DeadCodePass::Summary() const
+{
+    return to_string(folded) + " ifs folded, " + to_string(deadIfs) + " dead ifs, "
+           + to_string(deadStores) + " dead stores";
+}
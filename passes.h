@@ -0,0 +1,104 @@
+/*
+ * passes.h
+ */
+
+#ifndef PASSES_H_
+#define PASSES_H_
+
+#include <memory>
+#include "parsetree.h"
+
+// a Pass analyzes or rewrites a whole program. Run may replace the root and returns
+// true when it changed the tree.
+class Pass {
+public:
+    virtual ~Pass() {}
+    virtual const char *Name() const = 0;
+    virtual bool Run(ParseTree *&root) = 0;
+
+    // what the last run did, for the timing report
+    virtual string Summary() const { return ""; }
+};
+
+// PassManager runs its passes in the order they were added and times each one
+class PassManager {
+    struct Timing {
+        string	name;
+        double	ms;
+        bool	changed;
+        string	summary;
+    };
+
+    vector<std::unique_ptr<Pass>>	passes;
+    vector<Timing>	timings;
+
+public:
+    void Add(Pass *p) { passes.emplace_back(p); }
+    bool Empty() const { return passes.empty(); }
+
+    // returns true if any pass changed the tree
+    bool Run(ParseTree *&root);
+
+    void Report(ostream& out) const;
+};
+
+// MemoizePass wraps the largest pure subexpressions of each statement (no assignments
+// inside, at least one operator, a bounded number of variables read) in MemoExpr nodes
+class MemoizePass : public Pass {
+    int		wrapped = 0;
+
+    void Statement(ParseTree *&stmt);
+    void Expression(ParseTree *&expr);
+
+public:
+    static const size_t MAXREADS = 16;
+
+    const char *Name() const { return "memoize"; }
+    bool Run(ParseTree *&root);
+    string Summary() const { return to_string(wrapped) + " wrapped"; }
+    int Wrapped() const { return wrapped; }
+};
+
+// CsePass merges structurally equal pure subexpressions into one shared node (hash
+// consing) and wraps each merged operator node in a single MemoExpr, so a repeated
+// subexpression is evaluated once and then reused until a variable it reads is
+// assigned. Only nodes on the same line are merged, since a failure reports the line of
+// the node that failed.
+class CsePass : public Pass {
+    int		merged = 0;
+    int		shared = 0;
+
+public:
+    const char *Name() const { return "cse"; }
+    bool Run(ParseTree *&root);
+    string Summary() const { return to_string(merged) + " merged, " + to_string(shared) + " shared"; }
+    int Merged() const { return merged; }
+};
+
+// DeadCodePass folds if statements whose condition is a constant and removes
+// assignments whose value is never read, as long as the right-hand side cannot fail
+// at runtime; an assignment that might divide by zero or read an undefined variable
+// stays so that the program still stops there. With keepFinalStores, the last value
+// of every variable counts as read, for when the symbol table outlives the program.
+class DeadCodePass : public Pass {
+    bool	keepFinalStores;
+    int		folded = 0;
+    int		deadIfs = 0;
+    int		deadStores = 0;
+
+    // assignments whose right-hand side is sure to succeed where it stands, and ifs
+    // whose condition is sure to be a bool
+    set<const ParseTree*>	safe;
+    set<const ParseTree*>	sureConds;
+
+    ParseTree *Sweep(ParseTree *stmt, set<const string*>& live, bool removable);
+
+public:
+    DeadCodePass(bool keepFinalStores = false) : keepFinalStores(keepFinalStores) {}
+
+    const char *Name() const { return "dead-code"; }
+    bool Run(ParseTree *&root);
+    string Summary() const;
+};
+
+#endif /* PASSES_H_ */
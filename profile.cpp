@@ -0,0 +1,136 @@
+#include <cstring>
+#include <map>
+#include <sys/time.h>
+#include "profile.h"
+#include "parsetree.h"
+
+Profiler profiler;
+
+static void OnProf(int)
+{
+    profiler.Sample();
+}
+
+bool Profiler::Start()
+{
+    slots.assign(SLOTS, Slot{0, 0, 0, 0});
+    pool.resize(POOL);
+    used = 0;
+    samples = dropped = 0;
+    depth = 0;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = OnProf;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if( sigaction(SIGPROF, &sa, &saved) != 0 )
+        return false;
+
+    on = 1;
+    struct itimerval tv;
+    tv.it_interval.tv_sec = 0;
+    tv.it_interval.tv_usec = 1000000 / HZ;
+    tv.it_value = tv.it_interval;
+    if( setitimer(ITIMER_PROF, &tv, 0) != 0 ) {
+        Stop();
+        return false;
+    }
+    return true;
+}
+
+// the timer goes before the handler, or a late tick would hit the default action
+void Profiler::Stop()
+{
+    struct itimerval tv;
+    memset(&tv, 0, sizeof tv);
+    setitimer(ITIMER_PROF, &tv, 0);
+    sigaction(SIGPROF, &saved, 0);
+    on = 0;
+}
+
+// Profiled runs one statement the way its Eval does; an if is taken apart so that the
+// statement under it gets a frame too
+static Value Profiled(ParseTree *stmt, map<string, Value>& symbolMap)
+{
+    ProfileFrame frame(stmt);
+    if( stmt->GetKind() != IFNODE )
+        return stmt->Eval(symbolMap);
+    Value fail;
+    if( stmt->left->EvalCond(symbolMap, fail) )
+        return Profiled(stmt->right, symbolMap);
+    return fail;
+}
+
+// this follows StmtList::Eval, budget included
+Value Profiler::Eval(ParseTree *prog, map<string, Value>& symbolMap)
+{
+    if( prog->GetKind() != LISTNODE )
+        return Profiled(prog, symbolMap);
+    for( ParseTree *sl = prog; sl; sl = sl->right ) {
+        if( !evalBudget.Tick() )
+            return Value::Failure(evalBudget.exceeded, sl->left->GetLinenum());
+        Value v = Profiled(sl->left, symbolMap);
+        if( v.isFailure() )
+            return v;
+    }
+    return Value();
+}
+
+void Profiler::Sample()
+{
+    int n = depth;
+    if( n > MAXDEPTH )
+        n = MAXDEPTH;
+    if( n <= 0 || slots.empty() )
+        return;
+    samples++;
+
+    size_t h = n;
+    for( int i = 0; i < n; i++ )
+        h = h * 0x100000001b3ull ^ (size_t)stack[i];
+
+    for( size_t probe = 0; probe < SLOTS; probe++ ) {
+        Slot& s = slots[(h + probe) & (SLOTS - 1)];
+        if( s.count == 0 ) {
+            if( used + n > POOL )
+                break;
+            s.hash = h;
+            s.first = used;
+            s.depth = n;
+            for( int i = 0; i < n; i++ )
+                pool[used + i] = stack[i];
+            used += n;
+            s.count = 1;
+            return;
+        }
+        if( s.hash == h && s.depth == n
+            && memcmp(&pool[s.first], stack, n * sizeof stack[0]) == 0 ) {
+            s.count++;
+            return;
+        }
+    }
+    dropped++;
+}
+
+// different nodes on the same line with the same kinds fold into one stack
+void Profiler::WriteFolded(ostream& out) const
+{
+    map<string, unsigned long> folded;
+    for( const Slot& s : slots ) {
+        if( s.count == 0 )
+            continue;
+        string name;
+        for( int i = 0; i < s.depth; i++ ) {
+            const ParseTree *t = pool[s.first + i];
+            if( i )
+                name += ';';
+            name += NodeKindName(t->GetKind());
+            name += '@';
+            name += std::to_string(t->GetLinenum());
+        }
+        folded[name] += s.count;
+    }
+    for( auto& f : folded )
+        out << f.first << ' ' << f.second << '\n';
+}
@@ -0,0 +1,95 @@
+/*
+ * profile.h
+ */
+
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <atomic>
+#include <csignal>
+#include <map>
+using std::string;
+using std::vector;
+using std::ostream;
+using std::map;
+
+class ParseTree;
+class Value;
+
+// Profiler samples where evaluation is on a SIGPROF timer. Eval runs a program on a
+// path of its own that pushes each statement, and the statements under an if, on a
+// shadow stack; the signal handler copies that stack into a fixed table of distinct
+// stacks and bumps its count, so a long run needs no more memory than its first few
+// seconds. Expressions are not pushed: their time goes to the statement they belong
+// to, which already names the script line. The nodes' own Eval carries no profiling
+// code, so a run without the profiler pays nothing for it.
+//
+// Only the thread that calls Start is profiled; server workers never push frames.
+class Profiler {
+public:
+    static const int MAXDEPTH = 256;		// deeper frames are counted with their ancestor
+    static const int HZ = 997;				// off the round numbers, to avoid lockstep
+    static const size_t SLOTS = 1 << 16;	// distinct stacks
+    static const size_t POOL = 1 << 20;		// frames across all distinct stacks
+
+    volatile sig_atomic_t	on = 0;		// read by every frame while the handler runs
+
+    void Push(const ParseTree *t) {
+        if( depth < MAXDEPTH ) { stack[depth] = t; }
+        // the handler must see the frame before the depth that covers it
+        std::atomic_signal_fence(std::memory_order_release);
+        depth = depth + 1;
+    }
+    void Pop() { depth = depth - 1; }
+
+    // Start installs the handler and starts the timer; false if either fails
+    bool Start();
+    void Stop();
+
+    // Eval runs prog as prog->Eval would, with frames for its statements
+    Value Eval(ParseTree *prog, map<string, Value>& symbolMap);
+
+    // Sample is the signal handler's half: no allocation, no locks
+    void Sample();
+
+    // WriteFolded writes one "Kind@line;Kind@line count" line per stack, the format
+    // flame graph tools read. The nodes must still be alive.
+    void WriteFolded(ostream& out) const;
+
+    unsigned long Samples() const { return samples; }
+    unsigned long Dropped() const { return dropped; }
+
+private:
+    struct Slot {
+        size_t	hash;
+        size_t	first;		// where the stack starts in pool
+        int		depth;
+        unsigned long	count;
+    };
+
+    const ParseTree	*stack[MAXDEPTH];
+    volatile sig_atomic_t	depth = 0;
+
+    vector<Slot>	slots;
+    vector<const ParseTree*>	pool;
+    size_t	used = 0;
+    unsigned long	samples = 0;
+    unsigned long	dropped = 0;	// samples that found the table full
+    struct sigaction	saved;
+};
+
+extern Profiler profiler;
+
+// ProfileFrame keeps a node on the shadow stack for the length of a scope
+class ProfileFrame {
+    bool	pushed;
+
+public:
+    explicit ProfileFrame(const ParseTree *t) : pushed(profiler.on != 0) { if( pushed ) profiler.Push(t); }
+    ~ProfileFrame() { if( pushed ) profiler.Pop(); }
+};
+
+#endif /* PROFILE_H_ */
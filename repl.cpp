@@ -0,0 +1,26 @@
+#include "repl.h"
+#include "parse.h"
+#include "budget.h"
+
+void Repl(istream *in, int *linenum, map<string, Value>& symbols, bool prompt)
+{
+    while( true ) {
+        if( prompt )
+            cout << "> " << flush;
+
+        bool done;
+        ParseTree *stmt = ParseStatement(in, linenum, &done);
+        if( done )
+            break;
+        if( stmt == 0 )
+            continue;
+
+        Value result = evalBudget.Tick() ? stmt->Eval(symbols)
+                                         : Value::Failure(evalBudget.exceeded, stmt->GetLinenum());
+        if( result.isFailure() )
+            cout << result.getErrorLine() << ": RUNTIME ERROR " << result.getErrorText() << endl;
+        delete stmt;
+    }
+    if( prompt )
+        cout << endl;
+}
@@ -0,0 +1,19 @@
+/*
+ * repl.h
+ */
+
+#ifndef REPL_H_
+#define REPL_H_
+
+#include <iostream>
+#include <map>
+#include "value.h"
+using std::istream;
+using std::map;
+
+// Repl parses and runs one statement at a time from in, keeping symbols between
+// statements. Syntax and runtime errors are reported and the session carries on. With
+// prompt set a "> " is written before each statement.
+extern void Repl(istream *in, int *linenum, map<string, Value>& symbols, bool prompt);
+
+#endif /* REPL_H_ */
@@ -0,0 +1,368 @@
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <sstream>
+#include <iomanip>
+#include <iterator>
+#include <algorithm>
+#include <memory>
+#include <new>
+#include "server.h"
+#include "parse.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// a client gets this long to send its script and to take the reply, so an idle
+// connection cannot hold a worker; scripts are capped at MAXREQUEST bytes
+static const int IOTIMEOUT = 5;
+static const size_t MAXREQUEST = 16 << 20;
+
+// the evaluator recurses once per level of the tree, and a worker's stack is small
+static const int MAXDEPTH = 5000;
+
+// limits the operator leaves unset get these instead of being unlimited
+static const unsigned long DEFAULTSTEPS = 100000000;
+static const double DEFAULTSECONDS = 10;
+static const unsigned long DEFAULTOUTPUT = 16 << 20;
+static const unsigned long DEFAULTSTRING = 64 << 20;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void Stop(int)
+{
+    stopping = 1;
+}
+
+struct Conn {
+    int					fd;
+    Clock::time_point	accepted;
+};
+
+// ConnQueue hands accepted connections to the workers. It holds a bounded number and
+// refuses the rest, so a burst of clients can neither pile up in memory nor stall the
+// accept loop.
+class ConnQueue {
+    std::mutex				lock;
+    std::condition_variable	ready;
+    std::deque<Conn>		conns;
+    size_t					limit;
+    bool					closed = false;
+
+public:
+    ConnQueue(size_t limit) : limit(limit) {}
+
+    // returns false, leaving c to the caller, when the queue is full
+    bool TryPush(const Conn& c) {
+        std::lock_guard<std::mutex> l(lock);
+        if( conns.size() >= limit )
+            return false;
+        conns.push_back(c);
+        ready.notify_one();
+        return true;
+    }
+
+    // returns false once the queue is closed and empty
+    bool Pop(Conn& c) {
+        std::unique_lock<std::mutex> l(lock);
+        ready.wait(l, [this] { return closed || !conns.empty(); });
+        if( conns.empty() )
+            return false;
+        c = conns.front();
+        conns.pop_front();
+        return true;
+    }
+
+    void Close() {
+        std::lock_guard<std::mutex> l(lock);
+        closed = true;
+        ready.notify_all();
+    }
+};
+
+// ReadAll reads to end of file. It fails on a read error, which includes a receive
+// timeout, once text grows past limit, and once the deadline has passed, so a client
+// trickling bytes in is cut off too.
+static bool ReadAll(int fd, string& text, size_t limit = string::npos,
+                    Clock::time_point deadline = Clock::time_point::max())
+{
+    char buf[65536];
+    while( true ) {
+        if( Clock::now() > deadline )
+            return false;
+        ssize_t n = read(fd, buf, sizeof buf);
+        if( n < 0 && errno == EINTR )
+            continue;
+        if( n < 0 )
+            return false;
+        if( n == 0 )
+            return true;
+        text.append(buf, n);
+        if( text.size() > limit )
+            return false;
+    }
+}
+
+static bool WriteAll(int fd, const string& text)
+{
+    const char *p = text.data();
+    size_t left = text.size();
+    while( left ) {
+        ssize_t n = write(fd, p, left);
+        if( n < 0 && errno == EINTR )
+            continue;
+        if( n < 0 )
+            return false;
+        p += n;
+        left -= n;
+    }
+    return true;
+}
+
+static void Reply(int fd, int status, const string& out)
+{
+    WriteAll(fd, "STATUS " + to_string(status) + "\n" + out);
+}
+
+static void SetTimeouts(int fd)
+{
+    timeval tv = { IOTIMEOUT, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+}
+
+// Depth is the height of the tree, counting a statement list as one level; it walks
+// with an explicit stack since the tree may be too deep to recurse over
+static int Depth(const ParseTree *root)
+{
+    int deepest = 0;
+    vector<pair<const ParseTree*, int>> work(1, make_pair(root, 1));
+    while( !work.empty() ) {
+        const ParseTree *t = work.back().first;
+        int d = work.back().second;
+        work.pop_back();
+        deepest = max(deepest, d);
+        if( t->left )
+            work.push_back(make_pair(t->left, d + 1));
+        if( t->right )
+            work.push_back(make_pair(t->right, t->GetKind() == LISTNODE ? d : d + 1));
+    }
+    return deepest;
+}
+
+// Run parses and evaluates one script, writing what it prints to out, and returns
+// the request's status
+static int Run(const string& text, ostream& out)
+{
+    map<string, Value> symbols;
+    istringstream in(text);
+    int line = 0;
+    std::unique_ptr<ParseTree> prog(Prog(&in, &line));
+    if( !prog )
+        return 2;
+    if( Depth(prog.get()) > MAXDEPTH ) {
+        out << "PROGRAM NESTED TOO DEEPLY" << endl;
+        return 3;
+    }
+
+    Value result = prog->Eval(symbols);
+    if( result.isFailure() ) {
+        out << result.getErrorLine() << ": RUNTIME ERROR " << result.getErrorText() << endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Serve runs one request. Parser state, the budget and the output stream are all
+// thread-local, and the request interns into a pool of its own, so requests on
+// different workers share nothing and a request's names are freed when it ends.
+// A request that throws, say by running out of memory, fails alone.
+static void Serve(int fd, const Budget& limits)
+{
+    string text;
+    if( !ReadAll(fd, text, MAXREQUEST, Clock::now() + std::chrono::seconds(IOTIMEOUT)) ) {
+        Reply(fd, 3, text.size() > MAXREQUEST ? "REQUEST TOO LARGE\n" : "REQUEST NOT RECEIVED\n");
+        return;
+    }
+
+    StringPool pool;
+    PoolScope scope(&pool);
+    ostringstream out;
+    printOut = &out;
+    evalBudget = limits;
+    evalBudget.Start();
+
+    int status;
+    try {
+        status = Run(text, out);
+    }
+    catch( const std::bad_alloc& ) {
+        out.str("");
+        out << "OUT OF MEMORY" << endl;
+        status = 3;
+    }
+    catch( const std::exception& e ) {
+        out.str("");
+        out << "INTERNAL ERROR " << e.what() << endl;
+        status = 3;
+    }
+    printOut = &cout;
+
+    Reply(fd, status, out.str());
+}
+
+static void Worker(ConnQueue *queue, const Budget *limits, vector<double> *latencies)
+{
+    Conn c;
+    while( queue->Pop(c) ) {
+        Serve(c.fd, *limits);
+        close(c.fd);
+        std::chrono::duration<double, std::milli> took = Clock::now() - c.accepted;
+        latencies->push_back(took.count());
+    }
+}
+
+static void ReportLatency(vector<double>& ms, ostream& out)
+{
+    out << ms.size() << " requests";
+    if( ms.empty() ) {
+        out << endl;
+        return;
+    }
+    sort(ms.begin(), ms.end());
+    auto at = [&ms](double p) { return ms[min(ms.size() - 1, size_t(p * ms.size()))]; };
+    out << std::fixed << std::setprecision(3)
+        << ", latency ms: p50 " << at(0.50) << "  p90 " << at(0.90)
+        << "  p99 " << at(0.99) << "  p99.9 " << at(0.999) << "  max " << ms.back() << endl;
+}
+
+static bool Address(const string& path, sockaddr_un& addr)
+{
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if( path.size() >= sizeof addr.sun_path )
+        return false;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+int RunServer(const string& path, int nthreads, const Budget& limits)
+{
+    sockaddr_un addr;
+    if( !Address(path, addr) ) {
+        cerr << "SOCKET PATH TOO LONG " << path << endl;
+        return -1;
+    }
+
+    // a socket left behind by an earlier server is replaced, anything else is not
+    struct stat st;
+    if( stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode) )
+        unlink(path.c_str());
+
+    int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if( lfd < 0 || bind(lfd, (sockaddr *)&addr, sizeof addr) < 0 || listen(lfd, 128) < 0 ) {
+        cerr << "COULD NOT LISTEN ON " << path << ": " << strerror(errno) << endl;
+        if( lfd >= 0 )
+            close(lfd);
+        return -1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = Stop;
+    sigaction(SIGINT, &sa, 0);
+    sigaction(SIGTERM, &sa, 0);
+    signal(SIGPIPE, SIG_IGN);
+
+    Budget budget = limits;
+    if( budget.maxSteps == 0 )
+        budget.maxSteps = DEFAULTSTEPS;
+    if( budget.maxSeconds <= 0 )
+        budget.maxSeconds = DEFAULTSECONDS;
+    if( budget.maxOutput == 0 )
+        budget.maxOutput = DEFAULTOUTPUT;
+    if( budget.maxString == 0 )
+        budget.maxString = DEFAULTSTRING;
+
+    if( nthreads < 1 )
+        nthreads = 1;
+    ConnQueue queue(2 * nthreads);
+    vector<vector<double>> latencies(nthreads);
+    vector<thread> workers;
+    for( int i = 0; i < nthreads; i++ )
+        workers.push_back( thread(Worker, &queue, &budget, &latencies[i]) );
+
+    // poll with a timeout so a signal is noticed even if no client connects
+    unsigned long busy = 0;
+    while( !stopping ) {
+        pollfd p = { lfd, POLLIN, 0 };
+        if( poll(&p, 1, 200) <= 0 )
+            continue;
+        int fd = accept(lfd, 0, 0);
+        if( fd < 0 )
+            continue;
+        SetTimeouts(fd);
+        if( !queue.TryPush( Conn{ fd, Clock::now() } ) ) {
+            Reply(fd, 3, "SERVER BUSY\n");
+            close(fd);
+            busy++;
+        }
+    }
+
+    close(lfd);
+    unlink(path.c_str());
+    queue.Close();
+    for( auto& w : workers )
+        w.join();
+
+    vector<double> all;
+    for( auto& l : latencies )
+        all.insert(all.end(), l.begin(), l.end());
+    ReportLatency(all, cerr);
+    if( busy )
+        cerr << busy << " requests turned away busy" << endl;
+    return 0;
+}
+
+int RunClient(const string& path, istream *in)
+{
+    sockaddr_un addr;
+    if( !Address(path, addr) )
+        return -1;
+
+    string text( (istreambuf_iterator<char>(*in)), istreambuf_iterator<char>() );
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if( fd < 0 )
+        return -1;
+    if( connect(fd, (sockaddr *)&addr, sizeof addr) < 0 ) {
+        close(fd);
+        return -1;
+    }
+
+    // a server that refuses the script closes without reading it, which resets the
+    // connection once its reply has been read
+    signal(SIGPIPE, SIG_IGN);
+    WriteAll(fd, text);
+    shutdown(fd, SHUT_WR);
+    string reply;
+    bool ok = ReadAll(fd, reply) || (errno == ECONNRESET && reply.size());
+    close(fd);
+    if( !ok || reply.compare(0, 7, "STATUS ") != 0 )
+        return -1;
+
+    size_t eol = reply.find('\n');
+    if( eol == string::npos )
+        return -1;
+    cout.write(reply.data() + eol + 1, reply.size() - eol - 1);
+    return atoi(reply.c_str() + 7);
+}
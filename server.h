@@ -0,0 +1,29 @@
+/*
+ * server.h
+ */
+
+#ifndef SERVER_H_
+#define SERVER_H_
+
+#include <string>
+#include <iostream>
+#include "budget.h"
+using std::string;
+using std::istream;
+
+// RunServer stays resident on a Unix domain socket at path. Each connection sends one
+// script and shuts down its write side; the reply is a "STATUS n" line followed by
+// the script's output, where n is 0 on success, 1 after a runtime error and 2 after a
+// syntax error. Status 3 means the request was refused and the output says why: the
+// server was busy, the script was too large, too slow to arrive or nested too deeply,
+// or running it threw. Scripts run on a pool of nthreads workers, each with its own
+// symbol table, output buffer and a copy of limits; a limit left at zero gets a
+// default rather than none. SIGINT or SIGTERM stops the server, which then reports
+// request latency percentiles on cerr.
+extern int RunServer(const string& path, int nthreads, const Budget& limits);
+
+// RunClient sends the script in in to the server at path, copies the output to cout
+// and returns the script's status, or -1 if the server cannot be reached
+extern int RunClient(const string& path, istream *in);
+
+#endif /* SERVER_H_ */
@@ -0,0 +1,172 @@
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "snapshot.h"
+#include "intern.h"
+
+static const char MAGIC[8] = { 'P', 'L', 'S', 'N', 'A', 'P', '0', '1' };
+
+enum SnapType : uint8_t { SNAPINT, SNAPBOOL, SNAPSTRING, SNAPEMPTY };
+
+template <class T>
+static void Put(string& out, T v)
+{
+    out.append(reinterpret_cast<const char *>(&v), sizeof v);
+}
+
+bool SaveSnapshot(const string& file, const map<string, Value>& symbols)
+{
+    string out(MAGIC, sizeof MAGIC);
+    Put<uint32_t>(out, 0);
+
+    uint32_t count = 0;
+    for( auto& sym : symbols ) {
+        const Value& v = sym.second;
+        if( v.isFailure() )
+            continue;
+
+        Put<uint32_t>(out, sym.first.size());
+        if( v.isIntType() ) {
+            Put<uint8_t>(out, SNAPINT);
+            out += sym.first;
+            Put<int32_t>(out, v.getInteger());
+        }
+        else if( v.isBoolType() ) {
+            Put<uint8_t>(out, SNAPBOOL);
+            out += sym.first;
+            Put<uint8_t>(out, v.getBoolean());
+        }
+        else if( v.isError() ) {
+            Put<uint8_t>(out, SNAPEMPTY);
+            out += sym.first;
+        }
+        else {
+            Put<uint8_t>(out, SNAPSTRING);
+            out += sym.first;
+            const string& s = v.getString();
+            Put<uint32_t>(out, s.size());
+            out += s;
+        }
+        count++;
+    }
+    memcpy(&out[sizeof MAGIC], &count, sizeof count);
+
+    string tmp = file + ".tmp";
+    {
+        ofstream f(tmp, ios::binary | ios::trunc);
+        if( !f.write(out.data(), out.size()) )
+            return false;
+    }
+    return rename(tmp.c_str(), file.c_str()) == 0;
+}
+
+// Reader walks the mapped bytes and fails on anything that runs off the end
+class Reader {
+    const char	*p;
+    const char	*end;
+
+public:
+    Reader(const char *p, size_t size) : p(p), end(p + size) {}
+
+    template <class T>
+    bool Get(T& v) {
+        if( size_t(end - p) < sizeof v )
+            return false;
+        memcpy(&v, p, sizeof v);
+        p += sizeof v;
+        return true;
+    }
+
+    bool Bytes(size_t n, const char *&out) {
+        if( size_t(end - p) < n )
+            return false;
+        out = p;
+        p += n;
+        return true;
+    }
+
+    bool AtEnd() const { return p == end; }
+};
+
+static bool Decode(const char *data, size_t size, map<string, Value>& loaded)
+{
+    Reader r(data, size);
+    const char *magic;
+    uint32_t count;
+    if( !r.Bytes(sizeof MAGIC, magic) || memcmp(magic, MAGIC, sizeof MAGIC) != 0 || !r.Get(count) )
+        return false;
+
+    for( uint32_t i = 0; i < count; i++ ) {
+        uint32_t namelen;
+        uint8_t type;
+        const char *name;
+        if( !r.Get(namelen) || !r.Get(type) || !r.Bytes(namelen, name) )
+            return false;
+
+        Value v;
+        if( type == SNAPINT ) {
+            int32_t iv;
+            if( !r.Get(iv) ) return false;
+            v = Value((int)iv);
+        }
+        else if( type == SNAPBOOL ) {
+            uint8_t bv;
+            if( !r.Get(bv) ) return false;
+            v = Value(bv != 0);
+        }
+        else if( type == SNAPSTRING ) {
+            uint32_t len;
+            const char *s;
+            if( !r.Get(len) || !r.Bytes(len, s) ) return false;
+            v = Value(string(s, len));
+        }
+        else if( type != SNAPEMPTY ) {
+            return false;
+        }
+
+        // entries were written in map order, so each one goes at the end
+        loaded.emplace_hint(loaded.end(), string(name, namelen), v);
+    }
+    return r.AtEnd();
+}
+
+bool LoadSnapshot(const string& file, map<string, Value>& symbols)
+{
+    int fd = open(file.c_str(), O_RDONLY);
+    if( fd < 0 )
+        return false;
+
+    struct stat st;
+    if( fstat(fd, &st) < 0 || st.st_size == 0 ) {
+        close(fd);
+        return false;
+    }
+
+    void *data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if( data == MAP_FAILED )
+        return false;
+
+    map<string, Value> loaded;
+    bool ok = Decode(static_cast<const char *>(data), st.st_size, loaded);
+    munmap(data, st.st_size);
+    if( !ok )
+        return false;
+
+    if( symbols.empty() ) {
+        symbols.swap(loaded);
+    }
+    else {
+        for( auto& sym : loaded )
+            symbols[sym.first] = sym.second;
+    }
+
+    // variables changed without any assignment running, so cached results are stale
+    currentPool->NewGeneration();
+    return true;
+}
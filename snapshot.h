@@ -0,0 +1,32 @@
+/*
+ * snapshot.h
+ */
+
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include <string>
+#include <map>
+#include "value.h"
+using std::string;
+using std::map;
+
+// A snapshot is the symbol table written out in a compact binary form, so that a
+// prelude script can be run once and its variables loaded by later runs without
+// parsing or evaluating it again. Entries are stored in map order in host byte order:
+//
+//   "PLSNAP01"  u32 count
+//   per entry:  u32 namelen  u8 type  name  payload
+//
+// where the payload is an i32 for ints, a u8 for bools and u32 len + bytes for strings.
+// The empty Value an assignment evaluates to, which prints as TYPE ERROR, has no payload.
+
+// SaveSnapshot writes the table to a temporary file and renames it into place, so a
+// reader never sees a partial snapshot. Returns false if the file cannot be written.
+extern bool SaveSnapshot(const string& file, const map<string, Value>& symbols);
+
+// LoadSnapshot maps the file and adds its variables to symbols, replacing any with the
+// same name. Returns false, leaving symbols untouched, if the file is missing or bad.
+extern bool LoadSnapshot(const string& file, map<string, Value>& symbols);
+
+#endif /* SNAPSHOT_H_ */
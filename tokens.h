@@ -3,6 +3,7 @@
 
 #include <string>
 #include <iostream>
+#include <utility>
 using std::string;
 using std::istream;
 using std::ostream;
@@ -50,16 +51,24 @@ enum TokenType {
 class Token {
     TokenType	tt;
     string		lexeme;
+    const string	*sym;	// interned lexeme for identifiers and string constants
     int			lnum;
 
 public:
     Token() {
         tt = ERR;
+        sym = 0;
         lnum = -1;
     }
     Token(TokenType tt, string lexeme, int line) {
         this->tt = tt;
-        this->lexeme = lexeme;
+        this->lexeme = std::move(lexeme);
+        this->sym = 0;
+        this->lnum = line;
+    }
+    Token(TokenType tt, const string *sym, int line) {
+        this->tt = tt;
+        this->sym = sym;
         this->lnum = line;
     }
 
@@ -67,7 +76,8 @@ public:
     bool operator!=(const TokenType tt) const { return this->tt != tt; }
 
     TokenType	GetTokenType() const { return tt; }
-    string		GetLexeme() const { return lexeme; }
+    const string&	GetLexeme() const { return sym ? *sym : lexeme; }
+    const string	*GetSymbol() const { return sym; }
     int			GetLinenum() const { return lnum; }
 };
 
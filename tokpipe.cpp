@@ -0,0 +1,73 @@
+#include "tokpipe.h"
+#include "intern.h"
+
+TokenPipe::TokenPipe(istream *in, int line)
+    : slots(new Batch[SLOTS]), head(0), tail(0), stop(false), lexerWaiting(false), parserWaiting(false),
+      pos(0), finished(false), lastLine(line)
+{
+    lexer = std::thread(&TokenPipe::Produce, this, in, line, currentPool);
+}
+
+TokenPipe::~TokenPipe()
+{
+    stop.store(true);
+    Wake(lexerWaiting, space);
+    lexer.join();
+    delete [] slots;
+}
+
+void TokenPipe::Produce(istream *in, int line, StringPool *pool)
+{
+    PoolScope scope(pool);
+    bool end = false;
+    while( !end ) {
+        unsigned long t = tail.load(std::memory_order_relaxed);
+        Await(lexerWaiting, space, [&] {
+            return t - head.load() != SLOTS || stop.load();
+        });
+        if( stop.load(std::memory_order_relaxed) )
+            return;
+
+        Batch& b = slots[t & (SLOTS - 1)];
+        b.count = 0;
+        while( b.count < BATCH && !stop.load(std::memory_order_relaxed) ) {
+            b.toks[b.count] = getNextToken(in, &line);
+            b.lines[b.count] = line;
+            TokenType tt = b.toks[b.count++].GetTokenType();
+            if( tt == DONE || tt == ERR ) {
+                end = true;
+                break;
+            }
+        }
+        if( stop.load(std::memory_order_relaxed) )
+            return;
+        tail.store(t + 1);
+        Wake(parserWaiting, ready);
+    }
+}
+
+void TokenPipe::Next(Token& t, int& line)
+{
+    if( finished ) {
+        t = last;
+        line = lastLine;
+        return;
+    }
+
+    unsigned long h = head.load(std::memory_order_relaxed);
+    Await(parserWaiting, ready, [&] { return tail.load() != h; });
+
+    Batch& b = slots[h & (SLOTS - 1)];
+    t = std::move(b.toks[pos]);
+    line = b.lines[pos];
+    if( t == DONE || t == ERR ) {
+        finished = true;
+        last = t;
+        lastLine = line;
+    }
+    if( ++pos == b.count ) {
+        pos = 0;
+        head.store(h + 1);
+        Wake(lexerWaiting, space);
+    }
+}
@@ -0,0 +1,95 @@
+/*
+ * tokpipe.h
+ */
+
+#ifndef TOKPIPE_H_
+#define TOKPIPE_H_
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "tokens.h"
+
+class StringPool;
+
+// TokenPipe runs the lexer on its own thread, so that reading and lexing overlap with
+// parsing. Tokens travel in batches through a single-producer single-consumer ring:
+// the lexer fills the batch at tail and publishes it, the parser drains the batch at
+// head and hands the slot back. Neither side takes a lock while the ring is neither
+// full nor empty; a side that has to wait spins briefly and then sleeps until the
+// other side moves.
+class TokenPipe {
+public:
+    static const unsigned long SLOTS = 16;		// must be a power of two
+    static const unsigned long BATCH = 512;
+    static const int SPIN = 64;					// checks before a waiting side sleeps
+
+    // start lexing in from the given line
+    TokenPipe(istream *in, int line);
+
+    // stops the lexer at its next token; a lexer blocked on input is waited for
+    ~TokenPipe();
+
+    // Next moves the next token into t and sets line to the lexer line after it. The
+    // DONE or ERR token that ends the input repeats forever, as the lexer's would.
+    void Next(Token& t, int& line);
+
+private:
+    struct Batch {
+        Token		toks[BATCH];
+        int			lines[BATCH];
+        unsigned	count;
+    };
+
+    // the lexer interns into the pool of the thread that made the pipe
+    void Produce(istream *in, int line, StringPool *pool);
+
+    // Await returns once ok holds, sleeping on cv if spinning does not get it there.
+    // waiting tells the other side, which calls Wake after each move, to take the lock.
+    // The flag, the indexes and stop are stored and loaded in sequentially consistent
+    // order around a wait, so either the waiter sees the move or the mover sees the
+    // waiter.
+    template <class Ok>
+    void Await(std::atomic<bool>& waiting, std::condition_variable& cv, Ok ok) {
+        for( int i = 0; i < SPIN; i++ ) {
+            if( ok() ) return;
+            std::this_thread::yield();
+        }
+        std::unique_lock<std::mutex> l(lock);
+        waiting.store(true);
+        cv.wait(l, ok);
+        waiting.store(false, std::memory_order_relaxed);
+    }
+
+    void Wake(std::atomic<bool>& waiting, std::condition_variable& cv) {
+        if( waiting.load() ) {
+            std::lock_guard<std::mutex> l(lock);
+            cv.notify_one();
+        }
+    }
+
+    Batch	*slots;
+
+    // the indexes only grow; each lives on its own cache line so the two threads do
+    // not bounce one line between them
+    alignas(64) std::atomic<unsigned long>	head;	// next batch the parser reads
+    alignas(64) std::atomic<unsigned long>	tail;	// next batch the lexer fills
+    alignas(64) std::atomic<bool>	stop;
+
+    std::mutex				lock;
+    std::condition_variable	space;		// the lexer sleeps here on a full ring
+    std::condition_variable	ready;		// the parser sleeps here on an empty one
+    std::atomic<bool>		lexerWaiting;
+    std::atomic<bool>		parserWaiting;
+
+    // consumer side only
+    unsigned	pos;
+    bool		finished;
+    Token		last;
+    int			lastLine;
+
+    std::thread	lexer;
+};
+
+#endif /* TOKPIPE_H_ */
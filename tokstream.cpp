@@ -0,0 +1,68 @@
+#include <cstdlib>
+#include "tokstream.h"
+
+void TokenStream::Reset(istream *in, int line, TokenPipe *pipe)
+{
+    this->in = in;
+    this->pipe = pipe;
+    lexline = line;
+    head = tail = consumed = 0;
+}
+
+// the lexer runs ahead in batches, but stops after a semicolon so that
+// interactive input is never asked for more than one statement at a time
+void TokenStream::Fill()
+{
+    for( unsigned long n = 0; n < BATCH && tail - head < WINDOW; n++ ) {
+        unsigned long slot = tail & (RING - 1);
+        if( pipe )
+            pipe->Next(ring[slot], lexline);
+        else
+            ring[slot] = getNextToken(in, &lexline);
+        lines[slot] = lexline;
+        tail++;
+
+        TokenType tt = ring[slot].GetTokenType();
+        if( tt == SC || tt == DONE || tt == ERR )
+            break;
+    }
+}
+
+const Token& TokenStream::Peek(unsigned long k)
+{
+    if( k >= WINDOW )
+        abort();
+
+    // the lexer keeps returning DONE at end of input, so Fill always makes progress
+    while( head + k >= tail )
+        Fill();
+    return ring[(head + k) & (RING - 1)];
+}
+
+const Token& TokenStream::Get(int *line)
+{
+    if( head == tail )
+        Fill();
+
+    const Token& t = ring[head & (RING - 1)];
+    head++;
+    if( head > consumed )
+        consumed = head;
+    *line = lines[(consumed - 1) & (RING - 1)];
+    return t;
+}
+
+const Token& TokenStream::Last() const
+{
+    static const Token none;
+    if( head == 0 )
+        return none;
+    return ring[(head - 1) & (RING - 1)];
+}
+
+void TokenStream::PushBack(unsigned long n)
+{
+    if( n > head || head - n + RING < tail )
+        abort();
+    head -= n;
+}
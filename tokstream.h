@@ -0,0 +1,52 @@
+/*
+ * tokstream.h
+ */
+
+#ifndef TOKSTREAM_H_
+#define TOKSTREAM_H_
+
+#include "tokens.h"
+#include "tokpipe.h"
+
+// TokenStream holds tokens from the lexer in a ring buffer. The parser can peek any
+// number of tokens ahead and back up over tokens it already consumed, and it gets
+// tokens by reference instead of copying each lexeme.
+class TokenStream {
+public:
+    static const unsigned long RING = 256;	// must be a power of two
+    static const unsigned long BATCH = 32;
+    static const unsigned long WINDOW = RING / 2;	// max lookahead, the rest is history
+
+    TokenStream() : in(0), pipe(0), lexline(0), head(0), tail(0), consumed(0) {}
+
+    // start reading a new stream; line is the current line number of the stream.
+    // With a pipe, tokens for in come from the pipe's lexer thread instead.
+    void Reset(istream *in, int line, TokenPipe *pipe = 0);
+    istream *Source() const { return in; }
+
+    // look at the k'th token after the current position without consuming it
+    const Token& Peek(unsigned long k = 0);
+
+    // consume a token; *line is set to the lexer line after the furthest token consumed
+    const Token& Get(int *line);
+
+    // the most recently consumed token, or an ERR token if nothing was consumed
+    const Token& Last() const;
+
+    // give back the last n consumed tokens
+    void PushBack(unsigned long n = 1);
+
+private:
+    void Fill();
+
+    Token	ring[RING];
+    int		lines[RING];
+    istream	*in;
+    TokenPipe	*pipe;
+    int		lexline;
+    unsigned long	head;		// next token to hand out
+    unsigned long	tail;		// next slot the lexer fills
+    unsigned long	consumed;	// furthest position ever handed out
+};
+
+#endif /* TOKSTREAM_H_ */
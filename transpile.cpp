@@ -0,0 +1,536 @@
+#include <sstream>
+#include <climits>
+#include "transpile.h"
+#include "visitor.h"
+
+// CType is the type an expression has whenever its evaluation succeeds. CNONE means it
+// never succeeds, CERR is the empty Value an assignment yields and CANY is unknown.
+enum CType { CNONE, CINT, CBOOL, CSTR, CERR, CANY };
+
+static bool Native(CType t) { return t == CINT || t == CBOOL || t == CSTR; }
+
+static CType Join(CType a, CType b)
+{
+    if( a == CNONE ) return b;
+    if( b == CNONE || a == b ) return a;
+    return CANY;
+}
+
+// OperatorType follows the operators in value.h and parsetree.h: it is the type of the
+// result when the operator succeeds on operands of types l and r
+static CType OperatorType(NodeKind k, CType l, CType r)
+{
+    if( l == CNONE || r == CNONE )
+        return CNONE;
+    bool lk = l != CANY, rk = r != CANY;
+
+    switch( k ) {
+        case PLUSNODE:
+            if( lk && rk )
+                return l == r && (l == CINT || l == CSTR) ? l : CNONE;
+            if( lk || rk ) {
+                CType known = lk ? l : r;
+                return known == CINT || known == CSTR ? known : CNONE;
+            }
+            return CANY;
+
+        case MINUSNODE:
+        case DIVIDENODE:
+            return (lk && l != CINT) || (rk && r != CINT) ? CNONE : CINT;
+
+        case TIMESNODE:
+            if( lk && rk ) {
+                if( l == CINT && r == CINT ) return CINT;
+                if( (l == CINT && r == CSTR) || (l == CSTR && r == CINT) ) return CSTR;
+                if( l == CINT && r == CBOOL ) return CBOOL;
+                return CNONE;
+            }
+            if( lk ) return l == CINT ? CANY : l == CSTR ? CSTR : CNONE;
+            if( rk ) return r == CINT ? CANY : r == CSTR ? CSTR : r == CBOOL ? CBOOL : CNONE;
+            return CANY;
+
+        case ANDNODE:
+            return (lk && l != CBOOL) || (rk && r != CBOOL) ? CNONE : CBOOL;
+
+        case ORNODE:
+            if( lk && rk )
+                return l == CBOOL || r == CBOOL ? CBOOL : CNONE;
+            return CBOOL;
+
+        default: {
+            // ints and strings compare with their own kind, bools only for equality
+            bool eq = k == EQNODE || k == NEQNODE;
+            auto comparable = [eq](CType t) { return t == CINT || t == CSTR || (eq && t == CBOOL); };
+            if( lk && rk )
+                return l == r && comparable(l) ? CBOOL : CNONE;
+            if( (lk && !comparable(l)) || (rk && !comparable(r)) )
+                return CNONE;
+            return CBOOL;
+        }
+    }
+}
+
+typedef map<const string*, CType> SlotEnv;
+
+// CTypes works out the type of an expression given the types of the variables
+class CTypes : public TreeVisitor<CTypes, CType> {
+    const SlotEnv& env;
+
+public:
+    CTypes(const SlotEnv& env) : env(env) {}
+
+    CType VisitNode(ParseTree *t) { return CANY; }
+    CType VisitIConst(IConst *t) { return CINT; }
+    CType VisitBoolConst(BoolConst *t) { return CBOOL; }
+    CType VisitSConst(SConst *t) { return CSTR; }
+    CType VisitMemo(MemoExpr *t) { return Visit(t->left); }
+    CType VisitIdent(Ident *t) {
+        auto it = env.find(t->getSYMBOL());
+        return it == env.end() ? CNONE : it->second;
+    }
+    CType VisitArith(ParseTree *t) { return OperatorType(t->GetKind(), Visit(t->left), Visit(t->right)); }
+    CType VisitLogic(ParseTree *t) { return OperatorType(t->GetKind(), Visit(t->left), Visit(t->right)); }
+    CType VisitCompare(ParseTree *t) { return OperatorType(t->GetKind(), Visit(t->left), Visit(t->right)); }
+    CType VisitAssignment(Assignment *t) {
+        if( !t->left->IdentDefined() || Visit(t->right) == CNONE )
+            return CNONE;
+        return CERR;
+    }
+};
+
+// SlotTypes joins the types of everything assigned to each variable, anywhere in the
+// program; it is run until nothing changes
+class SlotTypes : public TreeVisitor<SlotTypes> {
+public:
+    SlotEnv env;
+    bool changed = false;
+
+    void VisitNode(ParseTree *t) { VisitChildren(t); }
+    void VisitStmtList(StmtList *t) { VisitStatements(t); }
+
+    // the right side is only evaluated when the left is a variable
+    void VisitAssignment(Assignment *t) {
+        if( !t->left->IdentDefined() )
+            return;
+        Visit(t->right);
+        CType& slot = env[t->left->getSYMBOL()];
+        CType joined = Join(slot, CTypes(env).Visit(t->right));
+        if( joined != slot ) {
+            slot = joined;
+            changed = true;
+        }
+    }
+};
+
+class HasAssignment : public TreeVisitor<HasAssignment, bool> {
+public:
+    bool VisitNode(ParseTree *t) {
+        return (t->left && Visit(t->left)) || (t->right && Visit(t->right));
+    }
+    bool VisitAssignment(Assignment *t) { return true; }
+};
+
+// AssignsMidway is true when a statement can assign a variable while an expression is
+// only partly evaluated, so reads must be copied where they happen
+static bool AssignsMidway(ParseTree *stmt)
+{
+    if( stmt->GetKind() == IFNODE )
+        return HasAssignment().Visit(stmt->left) || AssignsMidway(stmt->right);
+    if( stmt->GetKind() == ASSIGNNODE )
+        return HasAssignment().Visit(stmt->right);
+    return HasAssignment().Visit(stmt);
+}
+
+// Unconditional collects the variables a statement always assigns when it completes,
+// which is every assignment outside the body of an if
+class Unconditional : public TreeVisitor<Unconditional> {
+public:
+    set<const string*> names;
+
+    void VisitNode(ParseTree *t) { VisitChildren(t); }
+    void VisitIf(IfStatement *t) { Visit(t->left); }
+    void VisitAssignment(Assignment *t) {
+        if( !t->left->IdentDefined() )
+            return;
+        Visit(t->right);
+        names.insert(t->left->getSYMBOL());
+    }
+};
+
+static string IntText(int v)
+{
+    if( v == INT_MIN )
+        return "(-2147483647 - 1)";
+    return v < 0 ? "(" + std::to_string(v) + ")" : std::to_string(v);
+}
+
+// octal escapes always stop after three digits, so any byte can be followed by any other
+static string Quote(const string& s)
+{
+    string q = "\"";
+    for( unsigned char c : s ) {
+        if( c == '"' || c == '\\' ) {
+            q += '\\';
+            q += c;
+        }
+        else if( c >= ' ' && c < 127 && c != '?' ) {
+            q += c;
+        }
+        else {
+            char esc[5];
+            snprintf(esc, sizeof esc, "\\%03o", c);
+            q += esc;
+        }
+    }
+    return q + "\"";
+}
+
+// CppCode is a C++ expression for a node. Native types are plain int, bool or string
+// expressions; the others are expressions of type Value. Every check that can fail has
+// already been written out as a statement before the code is used.
+struct CppCode {
+    string text;
+    CType type;
+};
+
+// CppEmitter writes each statement as straight-line C++ that follows the order in which
+// the tree walker evaluates, returning a failure Value from the enclosing function at
+// the point the interpreter would. The line a failure reports is worked out here: ctx is
+// the line that Located in the enclosing nodes would stamp on a failure with none.
+class CppEmitter : public TreeVisitor<CppEmitter, CppCode> {
+    const SlotEnv&	slots;
+    set<const string*>	assigned;	// variables surely defined before this statement
+    map<const string*, string>	literals;
+    std::ostringstream	body;
+    string			indent;
+    int				temps = 0;
+    int				ctx = 0;
+    bool			snapshot = false;	// copy variable reads; an assignment may follow
+
+    static const int PARTSIZE = 256;
+
+    string Temp() { return "t" + std::to_string(temps++); }
+    string Line(int line) const { return std::to_string(line ? line : ctx); }
+
+    void Fail(const string& msg, int line) {
+        body << indent << "return Value::Failure(" << Quote(msg) << ", " << Line(line) << ");\n";
+    }
+
+    CppCode Child(ParseTree *t, int line) {
+        int saved = ctx;
+        ctx = line;
+        CppCode c = Visit(t);
+        ctx = saved;
+        return c;
+    }
+
+    static const char *Decl(CType t) {
+        return t == CINT ? "int" : t == CBOOL ? "bool" : t == CSTR ? "string" : "Value";
+    }
+
+    static string ValueOf(const CppCode& c) {
+        return Native(c.type) ? "ToValue(" + c.text + ")" : c.text;
+    }
+
+    static string Extract(const string& v, CType t) {
+        if( t == CINT ) return v + ".getInteger()";
+        if( t == CBOOL ) return v + ".isTrue()";
+        if( t == CSTR ) return v + ".getString()";
+        return v;
+    }
+
+    // Checked evaluates expr, a Value, and returns its failure stamped with line
+    CppCode Checked(const string& expr, CType result, int line) {
+        string v = Temp();
+        body << indent << "Value " << v << " = " << expr << ";\n";
+        body << indent << "if( " << v << ".isFailure() ) return Located(" << v << ", " << Line(line) << ");\n";
+        return CppCode{ Extract(v, result), result };
+    }
+
+    static const char *Operator(NodeKind k) {
+        switch( k ) {
+            case PLUSNODE:	return "+";
+            case MINUSNODE:	return "-";
+            case TIMESNODE:	return "*";
+            case DIVIDENODE:	return "/";
+            case EQNODE:	return "==";
+            case NEQNODE:	return "!=";
+            case LTNODE:	return "<";
+            case LEQNODE:	return "<=";
+            case GTNODE:	return ">";
+            default:		return ">=";
+        }
+    }
+
+public:
+    CppEmitter(const SlotEnv& slots) : slots(slots) {}
+
+    CppCode VisitNode(ParseTree *t) { return CppCode{ "Value()", CANY }; }
+    CppCode VisitMemo(MemoExpr *t) { return Visit(t->left); }
+    CppCode VisitIConst(IConst *t) { return CppCode{ IntText(t->getINTEGER()), CINT }; }
+    CppCode VisitBoolConst(BoolConst *t) { return CppCode{ t->getBOOLEAN() ? "true" : "false", CBOOL }; }
+
+    CppCode VisitSConst(SConst *t) {
+        string& name = literals[t->getSTRING()];
+        if( name.empty() )
+            name = "s" + std::to_string(literals.size() - 1);
+        return CppCode{ name, CSTR };
+    }
+
+    CppCode VisitIdent(Ident *t) {
+        const string *id = t->getSYMBOL();
+        auto it = slots.find(id);
+        if( it == slots.end() ) {
+            Fail("", t->GetLinenum());
+            return CppCode{ "Value()", CNONE };
+        }
+        if( !assigned.count(id) )
+            body << indent << "if( !d_" << *id << " ) return Value::Failure(\"\", " << Line(t->GetLinenum()) << ");\n";
+        if( !snapshot )
+            return CppCode{ "v_" + *id, it->second };
+        string v = Temp();
+        body << indent << Decl(it->second) << " " << v << " = v_" << *id << ";\n";
+        return CppCode{ v, it->second };
+    }
+
+    // a failure in the right operand is stamped with this node's line, in the left not
+    CppCode VisitArith(ParseTree *t) {
+        int line = t->GetLinenum();
+        CppCode l = Child(t->left, ctx);
+        CppCode r = Child(t->right, line ? line : ctx);
+        NodeKind k = t->GetKind();
+        CType res = OperatorType(k, l.type, r.type);
+
+        if( l.type == CINT && r.type == CINT ) {
+            if( k == PLUSNODE ) return CppCode{ "Add(" + l.text + ", " + r.text + ")", CINT };
+            if( k == MINUSNODE ) return CppCode{ "Sub(" + l.text + ", " + r.text + ")", CINT };
+            if( k == TIMESNODE ) return CppCode{ "Mul(" + l.text + ", " + r.text + ")", CINT };
+            string d = Temp();
+            body << indent << "int " << d << " = " << r.text << ";\n";
+            body << indent << "if( " << d << " == 0 ) ";
+            body << "return Value::Failure(\"Cant divide by 0 thats undefined\", " << Line(line) << ");\n";
+            return CppCode{ "Quotient(" + l.text + ", " + d + ")", CINT };
+        }
+        if( k == PLUSNODE && l.type == CSTR && r.type == CSTR )
+            return CppCode{ "(" + l.text + " + " + r.text + ")", CSTR };
+        if( k == TIMESNODE && res == CSTR && Native(l.type) && Native(r.type) ) {
+            const CppCode& s = l.type == CSTR ? l : r;
+            const CppCode& n = l.type == CSTR ? r : l;
+            string count = Temp();
+            body << indent << "int " << count << " = " << n.text << ";\n";
+            body << indent << "if( " << count << " < 0 ) ";
+            body << "return Value::Failure(\"String times negative number cant be done\", " << Line(line) << ");\n";
+            return CppCode{ "Repeat(" + s.text + ", " + count + ")", CSTR };
+        }
+        if( k == TIMESNODE && l.type == CINT && r.type == CBOOL ) {
+            body << indent << "if( " << l.text << " != -1 ) ";
+            body << "return Value::Failure(\"Cant do this stmt\", " << Line(line) << ");\n";
+            return CppCode{ "(!" + r.text + ")", CBOOL };
+        }
+        return Checked(ValueOf(l) + " " + Operator(k) + " " + ValueOf(r), res, line);
+    }
+
+    CppCode VisitCompare(ParseTree *t) {
+        int line = t->GetLinenum();
+        CppCode l = Child(t->left, ctx);
+        CppCode r = Child(t->right, line ? line : ctx);
+        NodeKind k = t->GetKind();
+
+        if( Native(l.type) && l.type == r.type && OperatorType(k, l.type, r.type) == CBOOL )
+            return CppCode{ "(" + l.text + " " + Operator(k) + " " + r.text + ")", CBOOL };
+        return Checked(ValueOf(l) + " " + Operator(k) + " " + ValueOf(r), OperatorType(k, l.type, r.type), line);
+    }
+
+    // or evaluates its right operand first
+    CppCode VisitLogic(ParseTree *t) {
+        CppCode l, r;
+        if( t->GetKind() == ANDNODE ) {
+            l = Visit(t->left);
+            r = Visit(t->right);
+        }
+        else {
+            r = Visit(t->right);
+            l = Visit(t->left);
+        }
+        CType res = OperatorType(t->GetKind(), l.type, r.type);
+
+        if( l.type == CBOOL && r.type == CBOOL )
+            return CppCode{ "(" + l.text + (t->GetKind() == ANDNODE ? " && " : " || ") + r.text + ")", CBOOL };
+        if( t->GetKind() == ORNODE && res == CBOOL && l.type != CANY && r.type != CANY )
+            return l.type == CBOOL ? l : r;
+        return Checked(string(t->GetKind() == ANDNODE ? "And(" : "Or(") + ValueOf(l) + ", " + ValueOf(r) + ")",
+                       res, t->GetLinenum());
+    }
+
+    CppCode VisitAssignment(Assignment *t) {
+        if( !t->left->IdentDefined() ) {
+            Fail("IDENT Type Expected", t->GetLinenum());
+            return CppCode{ "Value()", CNONE };
+        }
+        CppCode r = Visit(t->right);
+        const string *id = t->left->getSYMBOL();
+        CType slot = slots.at(id);
+
+        body << indent << "v_" << *id << " = ";
+        if( !Native(slot) )
+            body << ValueOf(r);
+        else if( r.type == slot )
+            body << r.text;
+        else
+            body << Extract(ValueOf(r), slot);
+        body << ";\n" << indent << "d_" << *id << " = true;\n";
+        return CppCode{ "Value()", r.type == CNONE ? CNONE : CERR };
+    }
+
+    CppCode VisitPrint(PrintStatement *t) {
+        CppCode v = Visit(t->left);
+        body << indent << "Print(" << v.text << ");\n";
+        return CppCode{ "Value()", CANY };
+    }
+
+    // a condition that is not a bool fails with the line of the condition itself
+    CppCode VisitIf(IfStatement *t) {
+        CppCode c = Visit(t->left);
+        if( c.type == CBOOL ) {
+            body << indent << "if( " << c.text << " ) {\n";
+        }
+        else {
+            string v = Temp();
+            body << indent << "Value " << v << " = " << ValueOf(c) << ";\n";
+            body << indent << "if( !" << v << ".isBoolType() ) ";
+            body << "return Value::Failure(\"Need Boolean Type\", " << Line(t->left->GetLinenum()) << ");\n";
+            body << indent << "if( " << v << ".isTrue() ) {\n";
+        }
+        indent += "    ";
+        Visit(t->right);
+        indent.resize(indent.size() - 4);
+        body << indent << "}\n";
+        return CppCode{ "Value()", CANY };
+    }
+
+    // Program writes the statements into functions of PARTSIZE statements each and
+    // returns how many functions there are
+    int Program(ParseTree *prog) {
+        int parts = 0, n = 0;
+        for( ParseTree *sl = prog; sl; sl = sl->right ) {
+            if( n++ % PARTSIZE == 0 ) {
+                if( parts )
+                    body << "    return Value();\n}\n\n";
+                body << "static Value Part" << parts++ << "()\n{\n";
+                indent = "    ";
+            }
+
+            ParseTree *stmt = sl->left;
+            snapshot = AssignsMidway(stmt);
+            ctx = 0;
+            Visit(stmt);
+
+            Unconditional u;
+            u.Visit(stmt);
+            assigned.insert(u.names.begin(), u.names.end());
+        }
+        if( parts )
+            body << "    return Value();\n}\n\n";
+        return parts;
+    }
+
+    void Declarations(ostream& out) const {
+        for( auto& s : slots )
+            out << "static " << Decl(s.second) << " v_" << *s.first << ";\n"
+                << "static bool d_" << *s.first << ";\n";
+        for( auto& l : literals )
+            out << "static const string " << l.second << "(" << Quote(*l.first) << ", " << l.first->size() << ");\n";
+        out << "\n";
+    }
+
+    string Body() const { return body.str(); }
+};
+
+// Repeat, And and Or are only referenced by some programs, so they are marked
+// [[maybe_unused]] to keep the generated file quiet under -Wall.
+static const char *prelude =
+    "#include <cstring>\n"
+    "#include \"value.h\"\n"
+    "\n"
+    "// int arithmetic wraps like the interpreter's does in practice\n"
+    "static inline int Add(int a, int b) { return int(unsigned(a) + unsigned(b)); }\n"
+    "static inline int Sub(int a, int b) { return int(unsigned(a) - unsigned(b)); }\n"
+    "static inline int Mul(int a, int b) { return int(unsigned(a) * unsigned(b)); }\n"
+    "\n"
+    "[[maybe_unused]] static string Repeat(const string& s, int n)\n"
+    "{\n"
+    "    string a;\n"
+    "    a.reserve(s.size() * n);\n"
+    "    for( int i = 0; i < n; ++i ) a += s;\n"
+    "    return a;\n"
+    "}\n"
+    "\n"
+    "static inline Value ToValue(int i) { return Value(i); }\n"
+    "static inline Value ToValue(bool b) { return Value(b); }\n"
+    "static inline Value ToValue(const string& s) { return Value(s); }\n"
+    "\n"
+    "static inline Value Located(Value v, int line)\n"
+    "{\n"
+    "    if( v.getErrorLine() == 0 ) v.setErrorLine(line);\n"
+    "    return v;\n"
+    "}\n"
+    "\n"
+    "[[maybe_unused]] static Value And(const Value& l, const Value& r)\n"
+    "{\n"
+    "    if( l.isBoolType() && r.isBoolType() ) return Value(l.isTrue() && r.isTrue());\n"
+    "    return Value::Failure(\"BOOL Type expected\");\n"
+    "}\n"
+    "\n"
+    "[[maybe_unused]] static Value Or(const Value& l, const Value& r)\n"
+    "{\n"
+    "    if( l.isBoolType() || r.isBoolType() ) return Value(l.isTrue() || r.isTrue());\n"
+    "    return Value::Failure(\"BOOL Type Expected\");\n"
+    "}\n"
+    "\n"
+    "static inline void Print(int i)\n"
+    "{\n"
+    "    char buf[12];\n"
+    "    char *start = FormatInt(i, buf + sizeof buf);\n"
+    "    cout.write(start, buf + sizeof buf - start);\n"
+    "    cout.put('\\n');\n"
+    "}\n"
+    "\n"
+    "static inline void Print(bool b) { cout << (b ? \"True\\n\" : \"False\\n\"); }\n"
+    "static inline void Print(const string& s) { cout.write(s.data(), s.size()); cout.put('\\n'); }\n"
+    "static inline void Print(const Value& v) { cout << v << '\\n'; }\n"
+    "\n";
+
+void EmitCpp(ParseTree *prog, const string& source, ostream& out)
+{
+    SlotTypes slots;
+    do {
+        slots.changed = false;
+        slots.VisitStatements(prog);
+    } while( slots.changed );
+
+    CppEmitter emit(slots.env);
+    int parts = emit.Program(prog);
+
+    out << "// generated from " << source << "; build with\n"
+        << "//   g++ -std=c++17 -O2 -I<source dir> this.cpp <source dir>/budget.cpp\n"
+        << prelude;
+    emit.Declarations(out);
+    out << emit.Body();
+
+    out << "int main(int argc, char *argv[])\n{\n"
+        << "    static Value (*const parts[])() = {";
+    for( int i = 0; i < parts; i++ )
+        out << (i % 8 ? " " : "\n        ") << "Part" << i << ",";
+    out << "\n    };\n"
+        << "    bool lines = argc > 1 && strcmp(argv[1], \"-lines\") == 0;\n"
+        << "    ios::sync_with_stdio(false);\n"
+        << "    for( auto part : parts ) {\n"
+        << "        Value result = part();\n"
+        << "        if( result.isFailure() ) {\n"
+        << "            cout << (lines ? result.getErrorLine() : 0) << \": RUNTIME ERROR \" << result.getErrorText() << endl;\n"
+        << "            return 1;\n"
+        << "        }\n"
+        << "    }\n"
+        << "    return 0;\n"
+        << "}\n";
+}
@@ -0,0 +1,24 @@
+/*
+ * transpile.h
+ */
+
+#ifndef TRANSPILE_H_
+#define TRANSPILE_H_
+
+#include <string>
+#include <iostream>
+#include "parsetree.h"
+using std::string;
+
+// EmitCpp writes prog out as a standalone C++ program whose output and exit status
+// match the interpreter's, including the final RUNTIME ERROR line (pass -lines to the
+// program to get the line number). Variables that only ever hold one type become native
+// ints, bools or strings and operators on them compile to plain C++; everything else
+// goes through Value from value.h, so the program must be built against this tree:
+//
+//   g++ -std=c++17 -O2 -I<source dir> prog.cpp <source dir>/budget.cpp
+//
+// The -max-* budgets and snapshots do not apply to the generated program.
+extern void EmitCpp(ParseTree *prog, const string& source, ostream& out);
+
+#endif /* TRANSPILE_H_ */
@@ -7,10 +7,43 @@
 
 #include <string>
 #include <iostream>
+#include "budget.h"
 using namespace std;
-extern void RunTimeError ( string );
 
 
+// FormatInt writes v in decimal so that it ends just before end and returns where it
+// starts. Digits are produced two at a time from a table; end needs 11 bytes before it.
+inline char *FormatInt(int v, char *end) {
+    static const char pairs[201] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    unsigned u = v < 0 ? 0u - (unsigned)v : (unsigned)v;
+    char *p = end;
+    while( u >= 100 ) {
+        unsigned i = (u % 100) * 2;
+        u /= 100;
+        *--p = pairs[i + 1];
+        *--p = pairs[i];
+    }
+    if( u >= 10 ) {
+        *--p = pairs[u * 2 + 1];
+        *--p = pairs[u * 2];
+    }
+    else {
+        *--p = char('0' + u);
+    }
+    if( v < 0 )
+        *--p = '-';
+    return p;
+}
+
+// Quotient divides b into a, which must not be 0. INT_MIN / -1 would trap, so a -1
+// divisor negates instead and wraps the way int + - and * do.
+inline int Quotient(int a, int b) {
+    return b == -1 ? int(0u - unsigned(a)) : a / b;
+}
+
 // object holds boolean, integer, or string, and remembers which it holds
 class Value {
     bool	bval;
@@ -25,13 +58,25 @@ public:
     Value(string sval) : bval(false), ival(0), sval(sval), type(isString) {}
 
     // in the case of an error, I use the value to hold the error message
-    Value(string sval, bool isError) : bval(false), ival(0), sval(sval), type(isTypeError) {}
+    Value(string sval, bool isError) : bval(isError), ival(0), sval(sval), type(isTypeError) {}
+
+    // a runtime failure travels up the tree as an error Value instead of exiting;
+    // bval marks it as a failure and ival holds the line it happened on
+    static Value Failure(string msg, int line = 0) {
+        Value v(msg, true);
+        v.ival = line;
+        return v;
+    }
 
     bool isBoolType() const { return type == VT::isBool; }
     bool isIntType() const { return type == VT::isInt; }
     bool isStringType() const { return type == VT::isString; }
     bool isError() const { return type == VT::isTypeError; }
     bool hasMessage() const { return isError() && sval.size() > 0; }
+    bool isFailure() const { return isError() && bval; }
+    int getErrorLine() const { return ival; }
+    void setErrorLine(int line) { ival = line; }
+    const string& getErrorText() const { return sval; }
     bool isTrue() const { return isBoolType() && bval; }
     bool getBoolean() const {
         if( !isBoolType() ) { throw "Not boolean valued"; }
@@ -58,98 +103,136 @@ public:
 
     friend ostream& operator<<(ostream& out, const Value& v) {
         if( v.type == VT::isBool ) out << (v.bval ? "True" : "False");
-        else if( v.type == VT::isInt ) out << v.ival;
+        else if( v.type == VT::isInt ) {
+            char buf[12];
+            char *start = FormatInt(v.ival, buf + sizeof buf);
+            out.write(start, buf + sizeof buf - start);
+        }
         else if( v.type == VT::isString ) out << v.sval;
         else if( v.sval.size() > 0 ) out << "RUNTIME ERROR " << v.sval;
         else out << "TYPE ERROR";
         return out;
     }
+
+    // PrintedSize is the number of bytes operator<< writes for this value
+    size_t PrintedSize() const {
+        if( type == VT::isBool ) return bval ? 4 : 5;
+        if( type == VT::isInt ) {
+            char buf[12];
+            return buf + sizeof buf - FormatInt(ival, buf + sizeof buf);
+        }
+        if( type == VT::isString ) return sval.size();
+        return sval.size() > 0 ? 14 + sval.size() : 10;
+    }
+
+    // Fail reports an operator error, passing along a failure from either operand first
+    Value Fail(const Value& v, const string& msg) const {
+        if( isFailure() ) { return *this; }
+        if( v.isFailure() ) { return v; }
+        return Failure(msg);
+    }
+
+    static const size_t CHARGEBYTES = 64 * 1024;	// copied between charges in Repeat
+
+    // TooLong is the failure for a string that would pass the budget's string limit
+    static Value TooLong(unsigned long bytes) {
+        return Failure("String of " + to_string(bytes) + " bytes is too long");
+    }
+
+    // Repeat checks the length against the string limit before anything is allocated,
+    // and is charged one step per 64 bytes as it copies, so that a step or time limit
+    // can stop a long repetition partway
+    static Value Repeat(const string& s, int n) {
+        unsigned long bytes = s.size() * (unsigned long)n;
+        if( bytes > evalBudget.StringLimit() )
+            return TooLong(bytes);
+        string a;
+        a.reserve(bytes);
+        size_t charged = 0;
+        for( int i=0; i < n; ++i) {
+            a += s;
+            if( a.size() - charged >= CHARGEBYTES || i == n - 1 ) {
+                if( !evalBudget.Charge((a.size() - charged) / 64) )
+                    return Failure(evalBudget.exceeded);
+                charged = a.size();
+            }
+        }
+        return a;
+    }
+
     Value operator+(const Value& v){
         if (type == isInt && v.type == isInt) { return Value(ival + v.ival); }
-        if(type == isString && v.type == isString) { return Value(sval + v.sval); }
-        RunTimeError("Cant add these two guys");
-        return Value();
+        if(type == isString && v.type == isString) {
+            if( sval.size() + v.sval.size() > evalBudget.StringLimit() )
+                return TooLong(sval.size() + v.sval.size());
+            if( !evalBudget.Charge((sval.size() + v.sval.size()) / 64) )
+                return Failure(evalBudget.exceeded);
+            return Value(sval + v.sval);
+        }
+        return Fail(v, "Cant add these two guys");
     }
     Value operator-(const Value& v){
         if(type == isInt && v.type ==isInt) { return Value(ival - v.ival); }
-        RunTimeError("Cant minus these two guys");
-        return Value();
+        return Fail(v, "Cant minus these two guys");
     }
     Value operator*(const Value& v){
         if (type == isInt && v.type == isInt) { return Value(ival * v.ival); }
         if (type == isInt && v.type == isString) {
-            if(getInteger() >= 0)
-            {
-                string a;
-                for( int i=0; i < ival; ++i) { a = a + v.sval; }
-                return a;
-            }
-            RunTimeError("String times negative number cant be done");
+            if(ival >= 0) { return Repeat(v.sval, ival); }
+            return Fail(v, "String times negative number cant be done");
         }
         if (type == isString && v.type == isInt) {
-            if(v.getInteger() >=0) {
-                string a;
-                for(int i=0; i <v.ival; ++i) { a = a+ sval; }
-                return a;
-            }
-            RunTimeError("String times negative number cant be done");
+            if(v.ival >=0) { return Repeat(sval, v.ival); }
+            return Fail(v, "String times negative number cant be done");
         }
         if (type== isInt && v.type == isBool) {
             if (ival == -1) {
                 bool ans = !v.bval;
                 return (ans);
             }
-            RunTimeError("Cant do this stmt");
+            return Fail(v, "Cant do this stmt");
         }
-        RunTimeError("Cant timmes these two");
-        return Value();
+        return Fail(v, "Cant timmes these two");
     }
     Value operator/(const Value& v) {
         if(type== isInt && v.type == isInt) {
-            if(v.ival != 0) { return Value( ival / v.ival ); }
-            RunTimeError("Cant divide by 0 thats undefined");
+            if(v.ival != 0) { return Value( Quotient(ival, v.ival) ); }
+            return Fail(v, "Cant divide by 0 thats undefined");
         }
-        RunTimeError("Cant divide these chief");
-        return Value();
+        return Fail(v, "Cant divide these chief");
     }
     Value operator<(const Value& v) {
         if (type == isInt && v.type == isInt) { return Value(ival < v.ival); }
         if (type == isString && v.type == isString) { return Value(sval < v.sval); }
-        RunTimeError("smth happened with this <");
-        return Value();
+        return Fail(v, "smth happened with this <");
     }
     Value operator<=(const Value& v) {
         if (type == isInt && v.type == isInt) { return Value(ival <= v.ival); }
         if (type == isString && v.type == isString) { return Value(sval <= v.sval); }
-        RunTimeError("smth happened with this <=");
-        return Value();
+        return Fail(v, "smth happened with this <=");
     }
     Value operator>(const Value& v) {
         if (type == isInt && v.type == isInt) { return Value(ival > v.ival); }
         if (type == isString && v.type == isString) { return Value(sval > v.sval); }
-        RunTimeError("smth happened with this >");
-        return Value();
+        return Fail(v, "smth happened with this >");
     }
     Value operator>=(const Value& v) {
         if (type == isInt && v.type == isInt) { return Value(ival >= v.ival); }
         if (type == isString && v.type == isString) { return Value(sval >= v.sval); }
-        RunTimeError("smth happened with this >=");
-        return Value();
+        return Fail(v, "smth happened with this >=");
     }
     Value operator==(const Value& v) {
         if (type == isInt && v.type == isInt) { return Value(ival == v.ival); }
         if (type == isString && v.type == isString) { return Value(sval == v.sval); }
         if (type == isBool && v.type == isBool) { return Value(bval == v.bval); }
-        RunTimeError("smth happened with ==");
-        return Value();
+        return Fail(v, "smth happened with ==");
     }
 
     Value operator!=(const Value& v) {
         if (type == isInt && v.type == isInt) { return Value(ival != v.ival); }
         if (type == isString && v.type == isString) { return Value(sval != v.sval); }
         if (type == isBool && v.type == isBool) { return Value(bval != v.bval); }
-        RunTimeError("smth happened with !=");
-        return Value();
+        return Fail(v, "smth happened with !=");
     }
 };
 
@@ -0,0 +1,71 @@
+/*
+ * visitor.h
+ */
+
+#ifndef VISITOR_H_
+#define VISITOR_H_
+
+#include "parsetree.h"
+
+// TreeVisitor dispatches on GetKind() with a switch instead of virtual calls. A visitor
+// derives from TreeVisitor<itself, result> and defines only the Visit methods it cares
+// about; the rest fall through to VisitNode.
+template <class Derived, class R = void>
+class TreeVisitor {
+    Derived *self() { return static_cast<Derived*>(this); }
+
+public:
+    R Visit(ParseTree *t) {
+        switch( t->GetKind() ) {
+            case LISTNODE:		return self()->VisitStmtList(static_cast<StmtList*>(t));
+            case IFNODE:		return self()->VisitIf(static_cast<IfStatement*>(t));
+            case ASSIGNNODE:	return self()->VisitAssignment(static_cast<Assignment*>(t));
+            case PRINTNODE:		return self()->VisitPrint(static_cast<PrintStatement*>(t));
+            case PLUSNODE:
+            case MINUSNODE:
+            case TIMESNODE:
+            case DIVIDENODE:	return self()->VisitArith(t);
+            case ANDNODE:
+            case ORNODE:		return self()->VisitLogic(t);
+            case EQNODE:
+            case NEQNODE:
+            case LTNODE:
+            case LEQNODE:
+            case GTNODE:
+            case GEQNODE:		return self()->VisitCompare(t);
+            case ICONSTNODE:	return self()->VisitIConst(static_cast<IConst*>(t));
+            case BCONSTNODE:	return self()->VisitBoolConst(static_cast<BoolConst*>(t));
+            case SCONSTNODE:	return self()->VisitSConst(static_cast<SConst*>(t));
+            case IDENTNODE:		return self()->VisitIdent(static_cast<Ident*>(t));
+            case MEMONODE:		return self()->VisitMemo(static_cast<MemoExpr*>(t));
+            default:			return self()->VisitNode(t);
+        }
+    }
+
+    // walk the statements of a list in order without recursing down the chain
+    void VisitStatements(ParseTree *list) {
+        for( ParseTree *sl = list; sl; sl = sl->right )
+            Visit(sl->left);
+    }
+
+    void VisitChildren(ParseTree *t) {
+        if( t->left ) Visit(t->left);
+        if( t->right ) Visit(t->right);
+    }
+
+    R VisitNode(ParseTree *t) { return R(); }
+    R VisitStmtList(StmtList *t) { return self()->VisitNode(t); }
+    R VisitIf(IfStatement *t) { return self()->VisitNode(t); }
+    R VisitAssignment(Assignment *t) { return self()->VisitNode(t); }
+    R VisitPrint(PrintStatement *t) { return self()->VisitNode(t); }
+    R VisitArith(ParseTree *t) { return self()->VisitNode(t); }
+    R VisitLogic(ParseTree *t) { return self()->VisitNode(t); }
+    R VisitCompare(ParseTree *t) { return self()->VisitNode(t); }
+    R VisitIConst(IConst *t) { return self()->VisitNode(t); }
+    R VisitBoolConst(BoolConst *t) { return self()->VisitNode(t); }
+    R VisitSConst(SConst *t) { return self()->VisitNode(t); }
+    R VisitIdent(Ident *t) { return self()->VisitNode(t); }
+    R VisitMemo(MemoExpr *t) { return self()->VisitNode(t); }
+};
+
+#endif /* VISITOR_H_ */